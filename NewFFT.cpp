@@ -5,23 +5,121 @@
 #include <opencv2/opencv.hpp>
 #include <fstream>
 #include <filesystem>
+#include <map>
+#include <new>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
 #include </home/thatchaoskid/Documents/FloatX/src/floatx.hpp>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FFT_X86_KERNELS 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define FFT_UNIX_SOCKETS 1
+#define FFT_MAPPED_SCRATCH 1
+#define FFT_GLOB 1
+#endif
+
 using namespace std;
 using namespace cv;
 using namespace flx;
 namespace fs = std::filesystem;
 
 const double PI = acos(-1);
-constexpr int f = 8;  // Number of bits for the exponent
-constexpr int l = 12; // Number of bits for the significand (fraction)
+// The format can be chosen at build time, e.g. -DFFT_EXPONENT_BITS=5 -DFFT_SIGNIFICAND_BITS=10
+#ifndef FFT_EXPONENT_BITS
+#define FFT_EXPONENT_BITS 8
+#endif
+#ifndef FFT_SIGNIFICAND_BITS
+#define FFT_SIGNIFICAND_BITS 12
+#endif
+constexpr int f = FFT_EXPONENT_BITS;    // Number of bits for the exponent
+constexpr int l = FFT_SIGNIFICAND_BITS; // Number of bits for the significand (fraction)
 
 // Single precision = (f = 8 bits) + (l = 23 bits) - Typical IEEE 754 single precision
 // Half precision = (f = 5 bits) + (l = 10 bits) - Reduced precision, useful for graphics and machine learning
 // Double precision = (f = 15 bits) + (l = 112 bits) - High precision for scientific computing (not directly supported in standard C++)
 // Bfloat16 = (f = 8 bits) + (l = 7 bits) - Balances wide range with precision, popular in machine learning (requires hardware or library support)
 
-typedef floatx<f, l> FloatX;
+typedef floatx<f, l> FloatX;    // The default format
+typedef floatx<5, 10> FloatHalf; // IEEE half precision
+typedef floatx<8, 7> BFloat16;  // bfloat16, float range with an 8 bit significand
+
+// Formats the pipeline can run in, chosen with --precision. Single and Double
+// are exactly float and double, so they run on the native types with no
+// floatx emulation at all.
+enum class Precision { Half, BFloat16, FloatX, Single, Double };
+
+// Bit widths of a scalar type, for file headers and for choosing kernels
+template <typename T> struct ScalarTraits;
+template <int E, int M> struct ScalarTraits<floatx<E, M>> {
+    static constexpr int exponentBits = E;
+    static constexpr int significandBits = M;
+};
+template <> struct ScalarTraits<float> {
+    static constexpr int exponentBits = 8;
+    static constexpr int significandBits = 23;
+};
+template <> struct ScalarTraits<double> {
+    static constexpr int exponentBits = 11;
+    static constexpr int significandBits = 52;
+};
+
+template <typename T> struct ScalarTag { typedef T type; };
+
+// Calls body(ScalarTag<T>()) with T the scalar type of precision. The pipeline
+// is written once as templates and every format is instantiated here.
+template <typename Body>
+auto dispatchPrecision(Precision precision, Body&& body) -> decltype(body(ScalarTag<FloatX>())) {
+    switch (precision) {
+        case Precision::Half: return body(ScalarTag<FloatHalf>());
+        case Precision::BFloat16: return body(ScalarTag<BFloat16>());
+        case Precision::Single: return body(ScalarTag<float>());
+        case Precision::Double: return body(ScalarTag<double>());
+        default: return body(ScalarTag<FloatX>());
+    }
+}
+
+const char* precisionName(Precision precision) {
+    switch (precision) {
+        case Precision::Half: return "fp16";
+        case Precision::BFloat16: return "bf16";
+        case Precision::Single: return "fp32";
+        case Precision::Double: return "fp64";
+        default: return "floatx";
+    }
+}
+
+bool parsePrecision(const std::string& name, Precision& precision) {
+    for (Precision p : {Precision::Half, Precision::BFloat16, Precision::FloatX, Precision::Single, Precision::Double}) {
+        if (name == precisionName(p)) {
+            precision = p;
+            return true;
+        }
+    }
+    return false;
+}
 
 FloatX sqrt_floatx(const FloatX& value) {
     return FloatX(sqrt(static_cast<double>(value)));
@@ -35,9 +133,10 @@ FloatX sin_floatx(const FloatX& value) {
     return FloatX(sin(static_cast<double>(value)));
 }
 
+template <typename T = FloatX>
 struct MyComplex {
-    FloatX real, imag;
-    MyComplex(FloatX r = 0.0, FloatX i = 0.0) : real(r), imag(i) {}
+    T real, imag;
+    MyComplex(T r = T(0.0), T i = T(0.0)) : real(r), imag(i) {}
 
     MyComplex operator+(const MyComplex& other) const {
         return MyComplex(real + other.real, imag + other.imag);
@@ -50,22 +149,319 @@ struct MyComplex {
     MyComplex operator*(const MyComplex& other) const {
         return MyComplex(real * other.real - imag * other.imag, real * other.imag + imag * other.real);
     }
-    FloatX abs() const {
-        return FloatX(sqrt(static_cast<double>(real * real + imag * imag)));
+    MyComplex conj() const {
+        return MyComplex(real, -imag);
+    }
+    T abs() const {
+        return T(sqrt(static_cast<double>(real * real + imag * imag)));
+    }
+};
+
+// Where the time goes. Counters add up the work done and scoped timers mark
+// the stages of an image (decode, row pass, column pass, metric, output) as
+// spans on the thread that ran them. Both stay out of the inner loops: a
+// counter is bumped once per pass, file or allocation, a timer covers a whole
+// pass rather than a panel, and it only tests one flag unless tracing was
+// switched on (--trace or --metrics).
+struct FFTCounters {
+    std::atomic<long long> transforms{0};   // 1D transforms run; a pair of real rows packed into one counts once
+    std::atomic<long long> bytesWritten{0}; // Bytes of spectra and blur maps saved
+    std::atomic<long long> allocations{0};  // Buffers handed out by AlignedAllocator
+};
+FFTCounters fftCounters;
+
+struct TraceEvent {
+    const char* name;
+    std::string detail;     // Shown as the span's argument, e.g. the image path
+    double start, duration; // Microseconds since tracing started
+};
+
+struct CounterSample {
+    double time;
+    long long transforms, bytesWritten, allocations;
+};
+
+// Spans are kept per thread, so recording one never takes a lock. The
+// buffers are only read or cleared while no transform is running.
+class Tracer {
+public:
+    struct ThreadEvents {
+        int thread = 0;
+        vector<TraceEvent> events;
+    };
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    // Clears what was recorded; the calling thread becomes thread 0 if it has not recorded before
+    void start() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& buffer : buffers) buffer->events.clear();
+            samples.clear();
+        }
+        local();
+        origin = std::chrono::steady_clock::now();
+        on.store(true, std::memory_order_relaxed);
+    }
+    void stop() { on.store(false, std::memory_order_relaxed); }
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void record(const char* name, const std::string& detail, double start, double end) {
+        local().events.push_back({name, detail, start, end - start});
+    }
+
+    // Adds the current counter values to the trace, once per image
+    void sampleCounters() {
+        if (!enabled()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        samples.push_back({now(), fftCounters.transforms.load(), fftCounters.bytesWritten.load(), fftCounters.allocations.load()});
+    }
+
+    const vector<std::unique_ptr<ThreadEvents>>& threads() const { return buffers; }
+    const vector<CounterSample>& counterSamples() const { return samples; }
+
+private:
+    ThreadEvents& local() {
+        thread_local ThreadEvents* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ThreadEvents());
+            buffers.back()->thread = static_cast<int>(buffers.size()) - 1;
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+
+    std::atomic<bool> on{false};
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    vector<std::unique_ptr<ThreadEvents>> buffers;
+    vector<CounterSample> samples;
+};
+Tracer fftTracer;
+
+// Records the span from construction to destruction when tracing is on
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name) : name(name), start(fftTracer.enabled() ? fftTracer.now() : -1.0) {}
+    ScopedTimer(const char* name, const std::string& detail) : ScopedTimer(name) {
+        if (start >= 0) this->detail = detail;
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer() {
+        if (start >= 0) fftTracer.record(name, detail, start, fftTracer.now());
+    }
+
+private:
+    const char* name;
+    double start;
+    std::string detail;
+};
+
+// Allocator returning storage aligned to a cache line, used for the spectrum buffers
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        fftCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// Row-major 2D matrix of MyComplex<T> held in a single aligned block.
+// Rows are padded to `stride` elements so that every row starts on a cache line.
+// A spectrum of real input may keep only its non-redundant half: fullCols is
+// then the width of the real input and cols = fullCols / 2 + 1. The missing
+// bins follow from F(y, x) = conj(F((rows - y) % rows, fullCols - x)).
+template <typename T = FloatX>
+struct ComplexMatrix {
+    typedef MyComplex<T> Complex;
+    int rows = 0;
+    int cols = 0;
+    int stride = 0;
+    int fullCols = 0; // 0 for an ordinary (full) matrix
+    double scale = 1.0; // Stored values are the transform times scale, see inputScale
+    vector<Complex, AlignedAllocator<Complex>> data;
+
+    ComplexMatrix() {}
+    ComplexMatrix(int r, int c) { resize(r, c); }
+
+    // Reallocates to r x c and sets every element to zero
+    void resize(int r, int c) {
+        const int perLine = 64 / sizeof(Complex) > 0 ? 64 / sizeof(Complex) : 1;
+        rows = r;
+        cols = c;
+        fullCols = 0;
+        scale = 1.0;
+        stride = (c + perLine - 1) / perLine * perLine;
+        data.assign(size_t(rows) * stride, Complex());
+    }
+
+    Complex* row(int y) { return data.data() + size_t(y) * stride; }
+    const Complex* row(int y) const { return data.data() + size_t(y) * stride; }
+    Complex& operator()(int y, int x) { return row(y)[x]; }
+    const Complex& operator()(int y, int x) const { return row(y)[x]; }
+
+    bool isHalfSpectrum() const { return fullCols > 0; }
+    int logicalCols() const { return isHalfSpectrum() ? fullCols : cols; }
+
+    // Any bin of the logical spectrum, reconstructing mirrored bins of a half spectrum
+    Complex at(int y, int x) const {
+        if (x < cols) return row(y)[x];
+        return row((rows - y) % rows)[fullCols - x].conj();
+    }
+    // How many bins of the logical spectrum the stored column x stands for (1 or 2)
+    int multiplicity(int x) const {
+        return isHalfSpectrum() && x > 0 && 2 * x != fullCols ? 2 : 1;
     }
 };
 
+const double defaultBlurCutoff = 0.2; // Normalized frequency above which energy counts as detail, see calculateBlurriness
+
+// Settings for processSingleImage, taken from the command line
+struct ProcessOptions {
+    bool writeCsv = false;     // Legacy text spectrum instead of .npy
+    bool headless = false;     // Never open HighGUI windows
+    bool saveSpectrum = true;  // Write the spectrum next to the image
+    bool scoreOnly = false;    // Only compute the blurriness, never keep the spectrum
+    int blurMapTile = 0;       // Tile size of a local blur map, 0 for none
+    int reduce = 1;            // Decode at 1/2, 1/4 or 1/8 size
+    double cutoff = defaultBlurCutoff;
+    Precision precision = Precision::FloatX;
+    size_t memoryBudget = 0;   // Bytes a spectrum may take in memory before it is streamed through a scratch file, 0 for no limit
+    string scratchDirectory;   // Where streamed spectra go, empty for the system temp directory
+};
+
+// Blurriness of overlapping square tiles, to tell sharp regions of an image
+// from out-of-focus ones. Tiles are tileSize pixels wide and start every
+// stride pixels; the last row and column of tiles is moved in to end at the
+// image border. scores is row-major, gridRows x gridCols.
+struct BlurMap {
+    int gridRows = 0, gridCols = 0;
+    int tileSize = 0, stride = 0;
+    int imageRows = 0, imageCols = 0;
+    double cutoff = defaultBlurCutoff;
+    vector<double> scores;
+
+    int tileTop(int gy) const { return min(gy * stride, imageRows - tileSize); }
+    int tileLeft(int gx) const { return min(gx * stride, imageCols - tileSize); }
+    double& operator()(int gy, int gx) { return scores[size_t(gy) * gridCols + gx]; }
+    double operator()(int gy, int gx) const { return scores[size_t(gy) * gridCols + gx]; }
+};
+
+// What the server mode reports for one image
+struct ImageReport {
+    bool ok = false;
+    std::string error;
+    int rows = 0, cols = 0;
+    double blurriness = 0;
+    double decodeMs = 0, fftMs = 0, metricMs = 0, saveMs = 0, totalMs = 0;
+};
+
+// Settings for scanImages, the batch mode behind --scan
+struct ScanOptions {
+    int ioThreads = 2;       // Threads reading, hashing and decoding files
+    int fftWorkers = 0;      // Threads analyzing decoded images, 0 = one per hardware thread
+    int queueCapacity = 0;   // Decoded images waiting for a worker, 0 = two per worker
+    std::string cachePath;   // Result cache, empty for none
+    std::string outputPath;  // JSON lines go here, empty for stdout
+};
+
+// Settings for analyzeVideo, the frame timeline behind --video
+struct VideoOptions {
+    int stride = 1;          // Score every stride-th frame
+    int skip = 0;            // Frames to pass over at the start
+    int maxFrames = 0;       // Stop after scoring this many frames, 0 for no limit
+    int topFrames = 5;       // How many of the sharpest frames to report
+    int workers = 0;         // Threads scoring frames, 0 = one per hardware thread
+    std::string outputPath;  // JSON lines go here, empty for stdout
+};
+
 // Declaration of functions used in the program. Definitions should follow.
-void fft(vector<MyComplex>& a, bool invert); // Performs the Fast Fourier Transform on a vector of MyComplex
-void saveFFTResults(const vector<vector<MyComplex>>& fftData, const string& filePath); // Saves the FFT results to a file
-void transpose(vector<vector<MyComplex>>& data); // Transposes a 2D vector of MyComplex
-void fft2D(vector<vector<MyComplex>>& data, bool invert); // Performs 2D FFT on a matrix of MyComplex
-double calculateBlurriness(const vector<vector<MyComplex>>& freqDomain); // Calculates the blurriness of an image based on its frequency domain representation
-void displayFrequencyMagnitude(const vector<vector<MyComplex>>& freqDomain); // Displays the magnitude of the frequencies in the frequency domain representation
-void processSingleImage(const string& inputPath); // Processes a single image for blurriness analysis
+// The FFT and everything that touches a spectrum is a template on the scalar
+// type T, defaulting to FloatX; dispatchPrecision picks T at run time.
+template <typename T> struct FFTPlan;
+template <typename T>
+void fft(vector<MyComplex<T>>& a, bool invert = false); // Performs the Fast Fourier Transform on a vector of MyComplex
+template <typename T>
+void fft(MyComplex<T>* a, const FFTPlan<T>& plan, bool invert); // In-place FFT of plan.n values using a precomputed plan
+template <typename T = FloatX>
+const FFTPlan<T>& getFFTPlan(int n); // Returns the cached plan for length n, building it on first use
+template <typename T>
+void saveFFTResults(const ComplexMatrix<T>& fftData, const string& filePath); // Saves the FFT results to a CSV text file (legacy)
+template <typename T>
+bool saveFFTResultsNpy(const ComplexMatrix<T>& fftData, const string& filePath); // Saves the FFT results as .npy plus a .json description
+template <typename T>
+void transposeBlock(const MyComplex<T>* src, size_t srcStride, MyComplex<T>* dst, size_t dstStride, int rows, int cols); // Cache-blocked transpose of a rows x cols block
+template <typename T>
+void fft2D(ComplexMatrix<T>& data, bool invert); // Performs 2D FFT on a matrix of MyComplex
+template <typename T>
+void fftColumns(ComplexMatrix<T>& data, bool invert); // FFT of every column of data, in place
+template <typename T>
+void fftColumnRange(MyComplex<T>* data, size_t stride, int rows, int x0, int x1, bool invert); // FFT of columns x0..x1-1 of rows stored stride values apart, in place
+template <typename T, typename Pixel>
+void rfft2D(const Pixel* pixels, size_t step, int rows, int cols, ComplexMatrix<T>& spectrum); // 2D FFT of real input into a half spectrum
+template <typename T>
+void rfft2D(const Mat& img, ComplexMatrix<T>& spectrum); // rfft2D of an 8-bit grayscale image
+template <typename T>
+double transformGrowth(int n); // Bound on how much an n point FFT can grow the largest value
+template <typename T, typename Pixel>
+double inputScale(const Pixel* pixels, size_t step, int rows, int cols, int transformRows, int transformCols); // Power of two that keeps transforms of the input inside the range of T
+template <typename T, typename Pixel>
+void rfft2DRows(const Pixel* pixels, size_t step, int rows, int cols, ComplexMatrix<T>& spectrum); // Row pass of rfft2D only
+template <typename T, typename Pixel>
+void rfftRows(const Pixel* pixels, size_t step, int rows, int cols, double scale, MyComplex<T>* out, size_t outStride); // Half spectra of rows, written out outStride values apart
+template <typename T>
+double calculateBlurriness(const ComplexMatrix<T>& freqDomain, double cutoff = defaultBlurCutoff); // Calculates the blurriness of an image based on its frequency domain representation
+template <typename T = FloatX, typename Pixel>
+double blurScore(const Pixel* pixels, size_t step, int rows, int cols, double cutoff = defaultBlurCutoff); // calculateBlurriness of the image without storing its spectrum
+template <typename T = FloatX>
+double blurScore(const Mat& img, double cutoff = defaultBlurCutoff); // blurScore of an 8-bit grayscale image
+int grayscaleReadFlag(int reduce); // imread flag for a grayscale decode at 1/reduce size
+template <typename T = FloatX, typename Pixel>
+void computeBlurMap(const Pixel* pixels, size_t step, int rows, int cols, int tileSize, double cutoff, BlurMap& map); // Blurriness of Hann windowed tiles overlapping by half
+template <typename T = FloatX>
+void computeBlurMap(const Mat& img, int tileSize, double cutoff, BlurMap& map); // computeBlurMap of an 8-bit grayscale image
+bool saveBlurMapNpy(const BlurMap& map, const string& filePath); // Saves the score grid as .npy plus a .json description
+template <typename T>
+void displayFrequencyMagnitude(const ComplexMatrix<T>& freqDomain); // Displays the magnitude of the frequencies in the frequency domain representation
+template <typename T>
+bool spectrumExceedsBudget(int rows, int cols, const ProcessOptions& options); // Whether the half spectrum of a rows x cols image must be streamed
+template <typename T, typename Pixel>
+bool streamSpectrum(const Pixel* pixels, size_t step, int rows, int cols, const ProcessOptions& options, const string& npyPath, double& blurriness, string& error); // rfft2D, blurriness and .npy through a scratch file, in bounded memory
+void processSingleImage(const string& inputPath, const ProcessOptions& options = ProcessOptions()); // Processes a single image for blurriness analysis
+template <typename T>
+void processSingleImage(const string& inputPath, const Mat& img, const ProcessOptions& options); // processSingleImage of a decoded image in the scalar type T
+ImageReport analyzeImage(const Mat& img, const string& resultsBase, const ProcessOptions& options); // Spectrum and blurriness of a decoded image, timed
+template <typename T>
+ImageReport analyzeImage(const Mat& img, ComplexMatrix<T>& spectrum, const string& resultsBase, const ProcessOptions& options); // analyzeImage in the scalar type T into spectrum
+string imageReportJson(const string& id, const ImageReport& report); // One line JSON for a report
+int serveRequests(std::istream& in, std::ostream& out, const ProcessOptions& options); // Answers requests until end of input or "quit"
+int serveUnixSocket(const string& socketPath, const ProcessOptions& options); // serveRequests for each connection to a local socket
+bool findImages(const string& target, vector<string>& paths, string& error); // Image files of a directory (recursively), a glob or a single path
+int scanImages(const string& target, const ProcessOptions& options, const ScanOptions& scan); // Scores every image of target in parallel, skipping those in the cache
+int analyzeVideo(const string& source, const ProcessOptions& options, const VideoOptions& video); // Blurriness timeline of a video or numbered frame sequence
 bool isPowerOfTwo(int n); // Checks if a number is a power of two
 int nextPowerOfTwo(int n); // Finds the next power of two greater than or equal to n
-void displayProgress(int current, int total); // Displays a progress bar
+bool writeTrace(const string& path); // Writes the spans and counter samples recorded by fftTracer as Chrome trace JSON
+void printMetrics(std::ostream& out); // Prints the time per stage and the counters recorded by fftTracer
+void setFFTThreadCount(int threads); // Sets the number of threads used by fft2D (0 = all hardware threads)
+void setSimdKernelsEnabled(bool enabled); // Switches the vectorized butterflies on or off (on by default when supported)
 void shiftDFT(Mat& fImage); // Shifts the zero-frequency component to the center of the spectrum
 
 size_t SafeIndex(size_t index, size_t size) {
@@ -97,257 +493,2737 @@ void shiftDFT(Mat& fImage) {
     tmp.copyTo(q2);
 }
 
-int progress_line_number = 100;
-void displayProgress(int current, int total) {
-    const int barWidth = 70;
-    float progress = static_cast<float>(current) / total;
-    int pos = barWidth * progress;
+// Vectorized FFT kernels for the emulated floatx formats.
+// floatx<E, M> keeps its value in a double and rounds after every operation.
+// The kernels below do the same operations on whole AVX2/SSE2 registers of
+// doubles and round each result with integer bit masks, so the output is
+// bit-for-bit what the scalar MyComplex code produces.
+template <int E, int M>
+struct FloatXRounding {
+    static constexpr int shift = 52 - M;                      // Dropped significand bits of a double
+    static constexpr int bias = (1 << (E - 1)) - 1;
+    static constexpr int minExponent = 1 - bias;
 
-    // Move up to the previous line of the progress bar
-    std::cout << "\033[" << progress_line_number << ";0H";
+    static double minNormal() { return std::ldexp(1.0, minExponent); }
+    static double maxFinite() { return std::ldexp(2.0 - std::ldexp(1.0, -M), bias); }
+    // Adding and subtracting this rounds a subnormal to a multiple of its spacing
+    static double subnormalMagic() { return std::ldexp(1.0, minExponent - M + 52); }
 
-    // If you have reached a new line (current is 0), increase the line number for the next call
-    if (current == 0) {
-        ++progress_line_number;
-    }
+    typedef MyComplex<floatx<E, M>> Complex;
+};
+// lo, hi = lo + w * hi, lo - w * hi over count consecutive values;
+// x = w * x over count consecutive values;
+// 4-point DFT across four runs of count values (twiddles already applied).
+// Null kernels mean plain MyComplex code.
+template <typename T>
+struct FFTKernels {
+    typedef MyComplex<T> Complex;
+    void (*butterfly)(Complex* lo, Complex* hi, const Complex* w, int count) = nullptr;
+    void (*multiply)(Complex* x, const Complex* w, int count) = nullptr;
+    void (*radix4)(Complex* x0, Complex* x1, Complex* x2, Complex* x3, int count, bool inverse) = nullptr;
+};
 
-    std::cout << "[";
-    for (int i = 0; i < barWidth; ++i) {
-        if (i < pos) std::cout << "=";
-        else if (i == pos) std::cout << ">";
-        else std::cout << " ";
-    }
-    std::cout << "] " << int(progress * 100.0) << " %\r";
-    std::cout.flush();
+// The scalar definitions: the kernels must match these exactly, and handle their tails with them
+template <typename T>
+inline void butterflyScalar(MyComplex<T>& lo, MyComplex<T>& hi, const MyComplex<T>& w) {
+    MyComplex<T> t = w * hi;
+    hi = lo - t;
+    lo = lo + t;
 }
 
+template <typename T>
+inline void radix4Scalar(MyComplex<T>& x0, MyComplex<T>& x1, MyComplex<T>& x2, MyComplex<T>& x3, bool inverse) {
+    MyComplex<T> t0 = x0 + x2, t1 = x0 - x2, t2 = x1 + x3, t3 = x1 - x3;
+    MyComplex<T> rotated(-t3.imag, t3.real); // i * t3, exact
+    x0 = t0 + t2;
+    x2 = t0 - t2;
+    x1 = inverse ? t1 - rotated : t1 + rotated;
+    x3 = inverse ? t1 + rotated : t1 - rotated;
+}
+
+#ifdef FFT_X86_KERNELS
+template <typename R>
+__attribute__((target("avx2"))) static inline __m256d roundFloatX(__m256d x) {
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    const __m256d magnitude = _mm256_andnot_pd(signMask, x);
+
+    // Round to nearest even: add half an ulp minus one plus the kept lsb, then truncate
+    __m256i bits = _mm256_castpd_si256(magnitude);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi64(bits, R::shift), _mm256_set1_epi64x(1));
+    bits = _mm256_add_epi64(bits, _mm256_add_epi64(_mm256_set1_epi64x((1LL << (R::shift - 1)) - 1), lsb));
+    bits = _mm256_and_si256(bits, _mm256_set1_epi64x(~((1LL << R::shift) - 1)));
+    __m256d rounded = _mm256_castsi256_pd(bits);
+    rounded = _mm256_blendv_pd(rounded, _mm256_set1_pd(INFINITY),
+                               _mm256_cmp_pd(rounded, _mm256_set1_pd(R::maxFinite()), _CMP_GT_OQ));
+
+    const __m256d magic = _mm256_set1_pd(R::subnormalMagic());
+    __m256d subnormal = _mm256_sub_pd(_mm256_add_pd(magnitude, magic), magic);
+    rounded = _mm256_blendv_pd(rounded, subnormal,
+                               _mm256_cmp_pd(magnitude, _mm256_set1_pd(R::minNormal()), _CMP_LT_OQ));
 
-void fft(vector<MyComplex>& a, bool inverse = false) {
-    int n = a.size();
-    cout << "FFT call with vector size: " << n << "\n";
+    rounded = _mm256_or_pd(rounded, _mm256_and_pd(signMask, x));
+    return _mm256_blendv_pd(rounded, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q)); // NaN passes through
+}
+
+// Two complex values per register: [re0, im0, re1, im1]
+template <typename R>
+__attribute__((target("avx2"))) static inline __m256d multiplyAVX2(__m256d w, __m256d x) {
+    __m256d p1 = roundFloatX<R>(_mm256_mul_pd(_mm256_movedup_pd(w), x));                                // wr*xr, wr*xi
+    __m256d p2 = roundFloatX<R>(_mm256_mul_pd(_mm256_permute_pd(w, 0xF), _mm256_permute_pd(x, 0x5)));   // wi*xi, wi*xr
+    return roundFloatX<R>(_mm256_addsub_pd(p1, p2));
+}
 
-    if (!isPowerOfTwo(n)) {
-        std::cerr << "Warning: Input size is not a power of two. Resizing to the nearest power of two.\n";
-        int newSize = nextPowerOfTwo(n);
-        a.resize(newSize, MyComplex()); // Pad with zeros
-        n = newSize;
+template <typename R>
+__attribute__((target("avx2"))) static void butterflyAVX2(typename R::Complex* lo, typename R::Complex* hi, const typename R::Complex* w, int count) {
+    double* a = reinterpret_cast<double*>(lo);
+    double* b = reinterpret_cast<double*>(hi);
+    const double* t = reinterpret_cast<const double*>(w);
+    int k = 0;
+    for (; k + 2 <= count; k += 2) {
+        __m256d av = _mm256_loadu_pd(a + 2 * k);
+        __m256d prod = multiplyAVX2<R>(_mm256_loadu_pd(t + 2 * k), _mm256_loadu_pd(b + 2 * k));
+        _mm256_storeu_pd(b + 2 * k, roundFloatX<R>(_mm256_sub_pd(av, prod)));
+        _mm256_storeu_pd(a + 2 * k, roundFloatX<R>(_mm256_add_pd(av, prod)));
     }
+    for (; k < count; ++k) butterflyScalar(lo[k], hi[k], w[k]);
+}
 
-    if (n <= 1) {
-        cout << "Completed FFT for vector size: " << n << " (base case)\n";
-        return;
+template <typename R>
+__attribute__((target("avx2"))) static void multiplyRunAVX2(typename R::Complex* x, const typename R::Complex* w, int count) {
+    double* a = reinterpret_cast<double*>(x);
+    const double* t = reinterpret_cast<const double*>(w);
+    int k = 0;
+    for (; k + 2 <= count; k += 2) {
+        _mm256_storeu_pd(a + 2 * k, multiplyAVX2<R>(_mm256_loadu_pd(t + 2 * k), _mm256_loadu_pd(a + 2 * k)));
     }
+    for (; k < count; ++k) x[k] = w[k] * x[k];
+}
 
-    vector<MyComplex> a_even(n / 2), a_odd(n / 2);
-    for (int i = 0; i < n / 2; i++) {
-        a_even[i] = a[2 * i];
-        a_odd[i] = a[2 * i + 1];
+template <typename R>
+__attribute__((target("avx2"))) static void radix4AVX2(typename R::Complex* x0, typename R::Complex* x1, typename R::Complex* x2, typename R::Complex* x3, int count, bool inverse) {
+    double* p0 = reinterpret_cast<double*>(x0);
+    double* p1 = reinterpret_cast<double*>(x1);
+    double* p2 = reinterpret_cast<double*>(x2);
+    double* p3 = reinterpret_cast<double*>(x3);
+    const __m256d negateReal = _mm256_set_pd(0.0, -0.0, 0.0, -0.0);
+    int k = 0;
+    for (; k + 2 <= count; k += 2) {
+        __m256d a0 = _mm256_loadu_pd(p0 + 2 * k), a1 = _mm256_loadu_pd(p1 + 2 * k);
+        __m256d a2 = _mm256_loadu_pd(p2 + 2 * k), a3 = _mm256_loadu_pd(p3 + 2 * k);
+        __m256d t0 = roundFloatX<R>(_mm256_add_pd(a0, a2)), t1 = roundFloatX<R>(_mm256_sub_pd(a0, a2));
+        __m256d t2 = roundFloatX<R>(_mm256_add_pd(a1, a3)), t3 = roundFloatX<R>(_mm256_sub_pd(a1, a3));
+        __m256d rotated = _mm256_xor_pd(_mm256_permute_pd(t3, 0x5), negateReal); // i * t3
+        __m256d plus = roundFloatX<R>(_mm256_add_pd(t1, rotated)), minus = roundFloatX<R>(_mm256_sub_pd(t1, rotated));
+        _mm256_storeu_pd(p0 + 2 * k, roundFloatX<R>(_mm256_add_pd(t0, t2)));
+        _mm256_storeu_pd(p2 + 2 * k, roundFloatX<R>(_mm256_sub_pd(t0, t2)));
+        _mm256_storeu_pd(p1 + 2 * k, inverse ? minus : plus);
+        _mm256_storeu_pd(p3 + 2 * k, inverse ? plus : minus);
     }
+    for (; k < count; ++k) radix4Scalar(x0[k], x1[k], x2[k], x3[k], inverse);
+}
+
+static inline __m128d selectBits(__m128d mask, __m128d ifTrue, __m128d ifFalse) {
+    return _mm_or_pd(_mm_and_pd(mask, ifTrue), _mm_andnot_pd(mask, ifFalse));
+}
 
-    fft(a_even, inverse);
-    fft(a_odd, inverse);
+template <typename R>
+static inline __m128d roundFloatX(__m128d x) {
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    const __m128d magnitude = _mm_andnot_pd(signMask, x);
 
-    FloatX angle = 2 * M_PI / FloatX(n) * (inverse ? -1 : 1);
-    MyComplex w(1), wn(cos_floatx(angle), sin_floatx(angle));
-    for (int k = 0; k < n / 2; k++) {
-        MyComplex t = w * a_odd[k];
-        a[k] = a_even[k] + t;
-        a[k + n / 2] = a_even[k] - t;
-        if (inverse) {
-            a[k].real = a[k].real / 2;
-            a[k].imag = a[k].imag / 2;
-            a[k + n / 2].real = a[k + n / 2].real / 2;
-            a[k + n / 2].imag = a[k + n / 2].imag / 2;
-        }
-        w = w * wn;
+    __m128i bits = _mm_castpd_si128(magnitude);
+    __m128i lsb = _mm_and_si128(_mm_srli_epi64(bits, R::shift), _mm_set1_epi64x(1));
+    bits = _mm_add_epi64(bits, _mm_add_epi64(_mm_set1_epi64x((1LL << (R::shift - 1)) - 1), lsb));
+    bits = _mm_and_si128(bits, _mm_set1_epi64x(~((1LL << R::shift) - 1)));
+    __m128d rounded = _mm_castsi128_pd(bits);
+    rounded = selectBits(_mm_cmpgt_pd(rounded, _mm_set1_pd(R::maxFinite())), _mm_set1_pd(INFINITY), rounded);
+
+    const __m128d magic = _mm_set1_pd(R::subnormalMagic());
+    __m128d subnormal = _mm_sub_pd(_mm_add_pd(magnitude, magic), magic);
+    rounded = selectBits(_mm_cmplt_pd(magnitude, _mm_set1_pd(R::minNormal())), subnormal, rounded);
+
+    rounded = _mm_or_pd(rounded, _mm_and_pd(signMask, x));
+    return selectBits(_mm_cmpunord_pd(x, x), x, rounded);
+}
+
+// One complex value per register: [re, im]
+template <typename R>
+static inline __m128d multiplySSE2(__m128d w, __m128d x) {
+    const __m128d negateReal = _mm_set_pd(0.0, -0.0);
+    __m128d p1 = roundFloatX<R>(_mm_mul_pd(_mm_unpacklo_pd(w, w), x));                      // wr*xr, wr*xi
+    __m128d p2 = roundFloatX<R>(_mm_mul_pd(_mm_unpackhi_pd(w, w), _mm_shuffle_pd(x, x, 1))); // wi*xi, wi*xr
+    return roundFloatX<R>(_mm_add_pd(p1, _mm_xor_pd(p2, negateReal)));
+}
+
+template <typename R>
+static void butterflySSE2(typename R::Complex* lo, typename R::Complex* hi, const typename R::Complex* w, int count) {
+    double* a = reinterpret_cast<double*>(lo);
+    double* b = reinterpret_cast<double*>(hi);
+    const double* t = reinterpret_cast<const double*>(w);
+    for (int k = 0; k < count; ++k) {
+        __m128d av = _mm_loadu_pd(a + 2 * k);
+        __m128d prod = multiplySSE2<R>(_mm_loadu_pd(t + 2 * k), _mm_loadu_pd(b + 2 * k));
+        _mm_storeu_pd(b + 2 * k, roundFloatX<R>(_mm_sub_pd(av, prod)));
+        _mm_storeu_pd(a + 2 * k, roundFloatX<R>(_mm_add_pd(av, prod)));
     }
 }
-bool isPowerOfTwo(int n) {
-    return (n & (n - 1)) == 0;
+
+template <typename R>
+static void multiplyRunSSE2(typename R::Complex* x, const typename R::Complex* w, int count) {
+    double* a = reinterpret_cast<double*>(x);
+    const double* t = reinterpret_cast<const double*>(w);
+    for (int k = 0; k < count; ++k) {
+        _mm_storeu_pd(a + 2 * k, multiplySSE2<R>(_mm_loadu_pd(t + 2 * k), _mm_loadu_pd(a + 2 * k)));
+    }
 }
 
-int nextPowerOfTwo(int n) {
-    if (n < 1) return 1;
-    int power = 1;
-    while (power < n) power <<= 1;
-    return power;
+template <typename R>
+static void radix4SSE2(typename R::Complex* x0, typename R::Complex* x1, typename R::Complex* x2, typename R::Complex* x3, int count, bool inverse) {
+    double* p0 = reinterpret_cast<double*>(x0);
+    double* p1 = reinterpret_cast<double*>(x1);
+    double* p2 = reinterpret_cast<double*>(x2);
+    double* p3 = reinterpret_cast<double*>(x3);
+    const __m128d negateReal = _mm_set_pd(0.0, -0.0);
+    for (int k = 0; k < count; ++k) {
+        __m128d a0 = _mm_loadu_pd(p0 + 2 * k), a1 = _mm_loadu_pd(p1 + 2 * k);
+        __m128d a2 = _mm_loadu_pd(p2 + 2 * k), a3 = _mm_loadu_pd(p3 + 2 * k);
+        __m128d t0 = roundFloatX<R>(_mm_add_pd(a0, a2)), t1 = roundFloatX<R>(_mm_sub_pd(a0, a2));
+        __m128d t2 = roundFloatX<R>(_mm_add_pd(a1, a3)), t3 = roundFloatX<R>(_mm_sub_pd(a1, a3));
+        __m128d rotated = _mm_xor_pd(_mm_shuffle_pd(t3, t3, 1), negateReal); // i * t3
+        __m128d plus = roundFloatX<R>(_mm_add_pd(t1, rotated)), minus = roundFloatX<R>(_mm_sub_pd(t1, rotated));
+        _mm_storeu_pd(p0 + 2 * k, roundFloatX<R>(_mm_add_pd(t0, t2)));
+        _mm_storeu_pd(p2 + 2 * k, roundFloatX<R>(_mm_sub_pd(t0, t2)));
+        _mm_storeu_pd(p1 + 2 * k, inverse ? minus : plus);
+        _mm_storeu_pd(p3 + 2 * k, inverse ? plus : minus);
+    }
 }
+#endif
 
-void saveFFTResults(const std::vector<std::vector<MyComplex>>& fftData, const std::string& filePath) {
-    std::ofstream file(filePath);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file for writing FFT results." << std::endl;
-        return;
+// The kernels assume floatx stores exactly the rounded double. Run them on a
+// few awkward values (ties, subnormals, overflow) and compare with the scalar
+// definitions before trusting them.
+template <int E, int M>
+bool kernelsMatchFloatX(const FFTKernels<floatx<E, M>>& kernels) {
+    typedef MyComplex<floatx<E, M>> Complex;
+    typedef FloatXRounding<E, M> Rounding;
+    static_assert(sizeof(Complex) == 2 * sizeof(double), "MyComplex must be two doubles for the SIMD kernels");
+    const double tiny = Rounding::minNormal();
+    const double samples[] = {1.0 / 3.0, -2.0 / 3.0, 1.0 + std::ldexp(1.0, -M - 1), 1.0 + 3 * std::ldexp(1.0, -M - 1),
+                              tiny * 0.3, -tiny * 0.75, Rounding::maxFinite(), 1e-300, 12345.678, -0.0};
+    const int count = sizeof(samples) / sizeof(samples[0]);
+    vector<Complex> x[4], w(count);
+    for (int r = 0; r < 4; ++r) {
+        x[r].resize(count);
+        for (int k = 0; k < count; ++k) {
+            x[r][k] = Complex(samples[(k + r) % count], 0.5 * samples[(k + 3 * r + 1) % count]);
+        }
     }
+    for (int k = 0; k < count; ++k) w[k] = Complex(std::cos(0.37 * k), std::sin(0.37 * k));
+    // The products of these raw doubles overflow inside the kernel
+    x[1][1] = Complex(Rounding::maxFinite(), -0.75);
+    w[1] = Complex(1.5, 0.25);
+
+    auto same = [&](const vector<Complex>& a, const vector<Complex>& b) {
+        return std::memcmp(a.data(), b.data(), count * sizeof(Complex)) == 0;
+    };
+    vector<Complex> y[4], ref[4];
+    for (int r = 0; r < 4; ++r) y[r] = ref[r] = x[r];
 
-    for (const auto& row : fftData) {
-        for (const auto& val : row) {
-            file << val.real << "," << val.imag << " ";
+    kernels.butterfly(y[0].data(), y[1].data(), w.data(), count);
+    for (int k = 0; k < count; ++k) butterflyScalar(ref[0][k], ref[1][k], w[k]);
+    kernels.multiply(y[2].data(), w.data(), count);
+    for (int k = 0; k < count; ++k) ref[2][k] = w[k] * ref[2][k];
+    if (!same(y[0], ref[0]) || !same(y[1], ref[1]) || !same(y[2], ref[2])) return false;
+
+    for (bool inverse : {false, true}) {
+        for (int r = 0; r < 4; ++r) y[r] = ref[r] = x[r];
+        kernels.radix4(y[0].data(), y[1].data(), y[2].data(), y[3].data(), count, inverse);
+        for (int k = 0; k < count; ++k) radix4Scalar(ref[0][k], ref[1][k], ref[2][k], ref[3][k], inverse);
+        for (int r = 0; r < 4; ++r) {
+            if (!same(y[r], ref[r])) return false;
         }
-        file << "\n";
     }
-    file.close();
+    return true;
 }
 
-void transpose(std::vector<std::vector<MyComplex>>& data) {
-    int n = data.size();
-    int m = data[0].size();
-    std::vector<std::vector<MyComplex>> result(m, std::vector<MyComplex>(n));
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < m; ++j) {
-            result[j][i] = data[i][j];
+bool simdKernelsEnabled = true;
+
+void setSimdKernelsEnabled(bool enabled) {
+    simdKernelsEnabled = enabled;
+}
+
+// Native float and double have no rounding to emulate; their plain MyComplex
+// code is already what the compiler vectorizes best
+template <typename T>
+struct KernelTable {
+    static FFTKernels<T> select() { return FFTKernels<T>(); }
+};
+
+// floatx formats narrower than double get the widest kernels the CPU supports
+template <int E, int M>
+struct KernelTable<floatx<E, M>> {
+    static FFTKernels<floatx<E, M>> select() {
+        FFTKernels<floatx<E, M>> kernels;
+#ifdef FFT_X86_KERNELS
+        if constexpr (E < 11 && M < 52) {
+            typedef FloatXRounding<E, M> R;
+            kernels = FFTKernels<floatx<E, M>>{butterflySSE2<R>, multiplyRunSSE2<R>, radix4SSE2<R>};
+            if (__builtin_cpu_supports("avx2")) kernels = FFTKernels<floatx<E, M>>{butterflyAVX2<R>, multiplyRunAVX2<R>, radix4AVX2<R>};
+        }
+#endif
+        if (kernels.butterfly && !kernelsMatchFloatX(kernels)) {
+            std::cerr << "Warning: SIMD kernels disagree with floatx rounding, using scalar FFT." << std::endl;
+            kernels = FFTKernels<floatx<E, M>>();
         }
+        return kernels;
     }
-    data = std::move(result);
+};
+
+// Picks the kernels for T once; null kernels mean plain MyComplex code
+template <typename T = FloatX>
+const FFTKernels<T>& getFFTKernels() {
+    static const FFTKernels<T> none;
+    static const FFTKernels<T> best = KernelTable<T>::select();
+    return simdKernelsEnabled ? best : none;
 }
 
-void fft2D(std::vector<std::vector<MyComplex>>& data, bool invert) {
-    int n = data.size(); // Number of rows, assuming square image for simplicity
-    int totalOperations = 2 * n; // Twice because we process rows first, then columns
-    int completedOperations = 0;
+// Persistent worker threads for the row and column passes of fft2D.
+// parallelFor cuts a range into chunks and deals them round-robin onto one
+// deque per thread. Each thread takes chunks from the front of its own deque
+// and, once that is empty, steals from the back of the others, so uneven rows
+// still keep every core busy. The calling thread works as queue 0.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) : queues(max(threads, 1)) {
+        for (auto& queue : queues) queue.reset(new WorkQueue());
+        for (int i = 1; i < static_cast<int>(queues.size()); ++i) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    int size() const { return queues.size(); }
+
+    // Runs body(chunkBegin, chunkEnd) over [begin, end) in chunks of at most grain items
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+        if (begin >= end) return;
+        grain = max(grain, 1);
+        if (workers.empty() || end - begin <= grain) {
+            for (int i = begin; i < end; i += grain) body(i, min(i + grain, end));
+            return;
+        }
 
-    // Process each row with FFT
-    for (auto& row : data) {
-        fft(row, invert);
-        completedOperations++;
-        displayProgress(completedOperations, totalOperations); // Update progress after each row
+        std::unique_lock<std::mutex> lock(jobMutex);
+        job = &body;
+        int chunks = 0;
+        for (int i = begin; i < end; i += grain, ++chunks) {
+            WorkQueue& queue = *queues[chunks % queues.size()];
+            std::lock_guard<std::mutex> queueLock(queue.mutex);
+            queue.chunks.emplace_back(i, min(i + grain, end));
+        }
+        pendingChunks.store(chunks);
+        ++generation;
+        lock.unlock();
+        jobReady.notify_all();
+
+        while (runOneChunk(0)) {}
+
+        lock.lock();
+        jobDone.wait(lock, [this] { return pendingChunks.load() == 0; });
+        job = nullptr;
     }
 
-    transpose(data);
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::pair<int, int>> chunks;
+    };
 
-    // Process each column (now row after transpose) with FFT
-    for (auto& row : data) {
-        fft(row, invert);
-        completedOperations++;
-        displayProgress(completedOperations, totalOperations); // Update progress after each column
+    bool popChunk(int self, std::pair<int, int>& chunk) {
+        const int count = queues.size();
+        for (int offset = 0; offset < count; ++offset) {
+            WorkQueue& queue = *queues[(self + offset) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.chunks.empty()) continue;
+            if (offset == 0) {
+                chunk = queue.chunks.front();
+                queue.chunks.pop_front();
+            } else {
+                chunk = queue.chunks.back();
+                queue.chunks.pop_back();
+            }
+            return true;
+        }
+        return false;
     }
 
-    // Ensure progress is marked complete at the end
-    displayProgress(totalOperations, totalOperations);
-    transpose(data);
+    bool runOneChunk(int self) {
+        std::pair<int, int> chunk;
+        if (!popChunk(self, chunk)) return false;
+        (*job)(chunk.first, chunk.second);
+        if (pendingChunks.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobDone.notify_all();
+        }
+        return true;
+    }
 
-    if (invert) {
-        int n = data.size();
-        int m = data[0].size();
-        for (int i = 0; i < n; ++i) {
-            for (int j = 0; j < m; ++j) {
-                data[i][j] = MyComplex(data[i][j].real / (n * m), data[i][j].imag / (n * m));
+    void workerLoop(int self) {
+        unsigned long seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobReady.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
             }
+            while (runOneChunk(self)) {}
         }
     }
+
+    vector<std::unique_ptr<WorkQueue>> queues;
+    vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobReady, jobDone;
+    const std::function<void(int, int)>* job = nullptr;
+    unsigned long generation = 0;
+    std::atomic<int> pendingChunks{0};
+    bool stopping = false;
+};
+
+int fftThreadCount = 0; // 0 = one thread per hardware thread
+std::unique_ptr<ThreadPool> fftPool;
+
+void setFFTThreadCount(int threads) {
+    if (threads != fftThreadCount) {
+        fftThreadCount = threads;
+        fftPool.reset();
+    }
+}
+
+ThreadPool& getFFTThreadPool() {
+    if (!fftPool) {
+        int threads = fftThreadCount > 0 ? fftThreadCount : static_cast<int>(std::thread::hardware_concurrency());
+        fftPool.reset(new ThreadPool(max(threads, 1)));
+    }
+    return *fftPool;
 }
 
+// Sets the fft2D thread count while it lives and puts the earlier one back
+// afterwards, so a scan inside a server or the Python module does not leave
+// every later transform single-threaded
+class ScopedFFTThreadCount {
+public:
+    explicit ScopedFFTThreadCount(int threads) : previous(fftThreadCount) { setFFTThreadCount(threads); }
+    ~ScopedFFTThreadCount() { setFFTThreadCount(previous); }
+    ScopedFFTThreadCount(const ScopedFFTThreadCount&) = delete;
+    ScopedFFTThreadCount& operator=(const ScopedFFTThreadCount&) = delete;
 
-double calculateBlurriness(const std::vector<std::vector<MyComplex>>& freqDomain) {
-    FloatX totalEnergy = 0.0;
-    FloatX highFreqEnergy = 0.0;
-    int cutoff = freqDomain.size() / 5; // Example threshold for high frequencies
+private:
+    int previous;
+};
+
+// Bounded multi-producer multi-consumer queue after Dmitry Vyukov's design.
+// Every slot carries a sequence number saying whose turn it is, so a push or
+// pop is one compare-and-swap on the shared position and never takes a lock.
+// tryPush and tryPop return false instead of waiting when the queue is full
+// or empty; push and pop wait on a condition variable instead, and only take
+// the mutex when some thread is actually waiting. The capacity is rounded up
+// to a power of two.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
 
-    for (int y = 0; y < freqDomain.size(); ++y) {
-        for (int x = 0; x < freqDomain[0].size(); ++x) {
-            // Use the abs() method from MyComplex for magnitude
-            FloatX magnitude = freqDomain[y][x].abs();
-            totalEnergy += magnitude;
-            if (x > cutoff && y > cutoff) {
-                highFreqEnergy += magnitude;
+    // Moves value into the queue, leaving it untouched when the queue is full
+    bool tryPush(T& value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
             }
         }
     }
 
-    FloatX ratio = highFreqEnergy / totalEnergy;
-    return ratio; // Lower ratio indicates a blurrier image
-}
+    bool tryPop(T& value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.value = T(); // Let go of whatever the moved-from value still holds
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
 
+    // Waits while the queue is full
+    void push(T& value) {
+        if (!tryPush(value)) {
+            wait(notFull, pushWaiters, [&] { return tryPush(value); });
+        }
+        wake(notEmpty, popWaiters);
+    }
 
-void displayFrequencyMagnitude(const std::vector<std::vector<MyComplex>>& freqDomain) {
-    int height = freqDomain.size();
-    int width = freqDomain[0].size();
-    Mat magnitudeImage = Mat::zeros(height, width, CV_32F);
-    
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            // Use the abs() method from MyComplex to calculate magnitude
-            float magnitude = freqDomain[y][x].abs();
-            magnitudeImage.at<float>(y, x) = magnitude;
+    // Waits while the queue is empty. Returns false once the queue is closed
+    // and every value pushed before close has been popped.
+    bool pop(T& value) {
+        bool popped = tryPop(value);
+        if (!popped) {
+            wait(notEmpty, popWaiters, [&] { return (popped = tryPop(value)) || closed; });
+            if (!popped) return false;
         }
+        wake(notFull, pushWaiters);
+        return true;
     }
 
-    magnitudeImage += Scalar::all(1); // Avoid log(0)
-    log(magnitudeImage, magnitudeImage);
+    // No more values will be pushed: wakes every thread waiting in pop
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
 
-    // Shift the zero-frequency component to the center
-    shiftDFT(magnitudeImage);
+private:
+    // A waiter counts itself before it checks the queue again, and the other
+    // side checks the count after changing the queue; with the fences between,
+    // one of them always sees the other, so no wake-up is lost
+    template <typename Ready>
+    void wait(std::condition_variable& condition, std::atomic<int>& waiters, Ready ready) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        condition.wait(lock, ready);
+        waiters.fetch_sub(1);
+    }
 
-    // Normalize the magnitude to a range [0, 1] for display purposes
-    normalize(magnitudeImage, magnitudeImage, 0, 1, NORM_MINMAX);
+    void wake(std::condition_variable& condition, std::atomic<int>& waiters) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            condition.notify_one();
+        }
+    }
 
-    // Display the dynamic range for diagnostic purposes
-    double minVal, maxVal;
-    minMaxLoc(magnitudeImage, &minVal, &maxVal);
-    cout << "Dynamic Range - MinVal: " << minVal << ", MaxVal: " << maxVal << endl;
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    std::atomic<int> popWaiters{0}, pushWaiters{0};
+    bool closed = false; // Guarded by mutex
+};
 
-    // Resize the image for better viewing if it's too large
-    double maxDimension = 800; // Maximum size of the window for either width or height
-    double scale = min(maxDimension / magnitudeImage.cols, maxDimension / magnitudeImage.rows);
-    Mat resizedMagnitudeImage;
-    resize(magnitudeImage, resizedMagnitudeImage, Size(), scale, scale, INTER_LINEAR);
+// One pass of the mixed-radix FFT. It combines `radix` interleaved
+// sub-transforms of length `span` into transforms of length radix * span.
+template <typename T>
+struct FFTStage {
+    int radix = 0;
+    int span = 0;
+    vector<MyComplex<T>> twiddles;      // w_L^(j*k) for j = 1..radix-1, k < span at (j - 1) * span + k, L = radix * span
+    vector<MyComplex<T>> inverseTwiddles;
+    vector<T> cosines, sines;           // cos and sin of 2*pi*r/radix, for the odd radix butterflies
+};
 
-    // Display the resized frequency magnitude image
-    imshow("Frequency Magnitude", resizedMagnitudeImage);
-    waitKey(0);
+// Precomputed tables for an FFT of one length. A plan is built once per size
+// and shared by every row, column and image of that size, so a transform only
+// permutes and combines values in place.
+// Lengths made of the factors 2, 3, 5 and 7 run as a sequence of radix 4, 2,
+// 3, 5 and 7 stages. Any other length is computed with Bluestein's chirp-z
+// algorithm as a circular convolution of power-of-two length.
+template <typename T>
+struct FFTPlan {
+    int n = 0;
+    vector<int> permutation;            // Input i moves to position permutation[i] before the stages run
+    bool permutationSwaps = false;      // The permutation is its own inverse (pure radix 2 and 4), swap in place
+    vector<FFTStage<T>> stages;
+
+    bool bluestein = false;
+    const FFTPlan* convolutionPlan = nullptr;         // Power-of-two plan of length >= 2n - 1
+    vector<MyComplex<T>> chirp, inverseChirp;         // exp(+-i*pi*k^2/n)
+    vector<MyComplex<T>> chirpSpectrum, inverseChirpSpectrum; // FFT of the conjugate chirp filter
+};
+
+const int largestRadix = 7;
+
+vector<int> factorFFTLength(int n) {
+    vector<int> radices;
+    while (n % 4 == 0) { radices.push_back(4); n /= 4; }
+    if (n % 2 == 0) { radices.push_back(2); n /= 2; }
+    for (int p = 3; p <= largestRadix; p += 2) {
+        while (n % p == 0) { radices.push_back(p); n /= p; }
+    }
+    if (n != 1) radices.clear(); // A prime factor larger than largestRadix remains
+    return radices;
 }
 
+template <typename T>
+FFTPlan<T> buildFFTPlan(int n) {
+    FFTPlan<T> plan;
+    plan.n = n;
+    vector<int> radices = factorFFTLength(n);
 
-void processSingleImage(const std::string& inputPath) {
-    // Construct the expected CSV file path
-    std::string fftResultsFilePath = inputPath + "_fft_results.csv";
+    if (radices.empty() && n > 1) {
+        // Bluestein: with jk = (j^2 + k^2 - (k - j)^2) / 2 the DFT becomes
+        // X_k = c_k * sum_j (x_j c_j) conj(c_(k-j)), c_j = exp(i*pi*j^2/n),
+        // which is a convolution that a power-of-two FFT can evaluate.
+        plan.bluestein = true;
+        const int m = nextPowerOfTwo(2 * n - 1);
+        plan.convolutionPlan = &getFFTPlan<T>(m);
+        plan.chirp.resize(n);
+        plan.inverseChirp.resize(n);
+        for (int k = 0; k < n; ++k) {
+            // k^2 mod 2n keeps the angle small and accurate
+            double angle = PI * double((long long)k * k % (2LL * n)) / n;
+            plan.chirp[k] = MyComplex<T>(cos(angle), sin(angle));
+            plan.inverseChirp[k] = MyComplex<T>(cos(angle), -sin(angle));
+        }
+        plan.chirpSpectrum.assign(m, MyComplex<T>());
+        plan.inverseChirpSpectrum.assign(m, MyComplex<T>());
+        for (int k = 0; k < n; ++k) {
+            plan.chirpSpectrum[k] = plan.inverseChirp[k];
+            plan.inverseChirpSpectrum[k] = plan.chirp[k];
+            if (k > 0) {
+                plan.chirpSpectrum[m - k] = plan.inverseChirp[k];
+                plan.inverseChirpSpectrum[m - k] = plan.chirp[k];
+            }
+        }
+        fft(plan.chirpSpectrum.data(), *plan.convolutionPlan, false);
+        fft(plan.inverseChirpSpectrum.data(), *plan.convolutionPlan, false);
+        return plan;
+    }
 
-    // Check if the CSV file exists and delete it if it does
-    if (fs::exists(fftResultsFilePath)) {
-        fs::remove(fftResultsFilePath);
-        std::cout << "Existing FFT results file removed: " << fftResultsFilePath << std::endl;
+    // Stages run in the order of radices; stage s has span radices[0] * ... * radices[s - 1].
+    // Input index i written in mixed radix (last radix least significant) lands at the
+    // digit-reversed position, which generalises the bit reversal of radix 2.
+    plan.permutation.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int rest = i, position = 0, place = n;
+        for (int s = static_cast<int>(radices.size()) - 1; s >= 0; --s) {
+            place /= radices[s];
+            position += (rest % radices[s]) * place;
+            rest /= radices[s];
+        }
+        plan.permutation[i] = position;
+    }
+    plan.permutationSwaps = true;
+    for (int i = 0; i < n; ++i) {
+        if (plan.permutation[plan.permutation[i]] != i) plan.permutationSwaps = false;
     }
 
-    Mat img = imread(inputPath, IMREAD_GRAYSCALE);
-    if (img.empty()) {
-        std::cerr << "Error loading image: " << inputPath << std::endl;
-        return;
+    // Twiddles are evaluated in double and rounded once, instead of being
+    // accumulated with w = w * wn in T.
+    int span = 1;
+    for (int radix : radices) {
+        FFTStage<T> stage;
+        stage.radix = radix;
+        stage.span = span;
+        const int length = radix * span;
+        stage.twiddles.resize((radix - 1) * span);
+        stage.inverseTwiddles.resize((radix - 1) * span);
+        for (int j = 1; j < radix; ++j) {
+            for (int k = 0; k < span; ++k) {
+                double angle = 2 * PI * double(j * k) / length;
+                stage.twiddles[(j - 1) * span + k] = MyComplex<T>(cos(angle), sin(angle));
+                stage.inverseTwiddles[(j - 1) * span + k] = MyComplex<T>(cos(angle), -sin(angle));
+            }
+        }
+        for (int r = 0; r < radix; ++r) {
+            stage.cosines.push_back(cos(2 * PI * r / radix));
+            stage.sines.push_back(sin(2 * PI * r / radix));
+        }
+        plan.stages.push_back(std::move(stage));
+        span *= radix;
     }
+    return plan;
+}
 
-    imshow("Original Image", img);
-    waitKey(0);
+template <typename T>
+const FFTPlan<T>& getFFTPlan(int n) {
+    static std::map<int, FFTPlan<T>> cache;
+    static std::recursive_mutex cacheMutex; // A Bluestein plan builds its convolution plan while holding it
+    std::lock_guard<std::recursive_mutex> lock(cacheMutex);
+    auto it = cache.find(n);
+    if (it == cache.end()) {
+        it = cache.emplace(n, buildFFTPlan<T>(n)).first;
+    }
+    return it->second;
+}
 
-    int width = img.cols;
-    int height = img.rows;
+// Odd prime radix butterfly on x[0..p), pairing x_j with x_(p-j):
+// X_q = x_0 + sum_j (x_j + x_(p-j)) cos(2*pi*jq/p) +- i (x_j - x_(p-j)) sin(2*pi*jq/p)
+template <typename T>
+void oddRadixButterfly(MyComplex<T>* x, const FFTStage<T>& stage, bool inverse) {
+    const int p = stage.radix;
+    const int pairs = (p - 1) / 2;
+    MyComplex<T> sums[largestRadix / 2], diffs[largestRadix / 2], out[largestRadix];
 
-    std::vector<std::vector<MyComplex>> imageData(height, std::vector<MyComplex>(width));
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            imageData[y][x] = MyComplex(img.at<uchar>(y, x), 0);
+    MyComplex<T> dc = x[0];
+    for (int j = 1; j <= pairs; ++j) {
+        sums[j - 1] = x[j] + x[p - j];
+        diffs[j - 1] = x[j] - x[p - j];
+        dc = dc + sums[j - 1];
+    }
+    out[0] = dc;
+    for (int q = 1; q <= pairs; ++q) {
+        MyComplex<T> cosPart = x[0], sinPart;
+        for (int j = 1; j <= pairs; ++j) {
+            const int r = (j * q) % p;
+            const T c = stage.cosines[r], sn = stage.sines[r];
+            cosPart = cosPart + MyComplex<T>(sums[j - 1].real * c, sums[j - 1].imag * c);
+            sinPart = sinPart + MyComplex<T>(diffs[j - 1].real * sn, diffs[j - 1].imag * sn);
         }
+        // i * sinPart is exact; the forward transform adds it to X_q and subtracts it from X_(p-q)
+        MyComplex<T> rotated(-sinPart.imag, sinPart.real);
+        out[q] = inverse ? cosPart - rotated : cosPart + rotated;
+        out[p - q] = inverse ? cosPart + rotated : cosPart - rotated;
     }
+    for (int q = 0; q < p; ++q) x[q] = out[q];
+}
 
-    fft2D(imageData, false); // Perform FFT
-    saveFFTResults(imageData, fftResultsFilePath); // Save FFT results
-    
-    FloatX blurriness = calculateBlurriness(imageData);
-    std::cout << "Blurriness: " << blurriness << std::endl;
+template <typename T>
+void runStage(MyComplex<T>* a, int n, const FFTStage<T>& stage, bool inverse, const FFTKernels<T>& kernels) {
+    const int radix = stage.radix;
+    const int span = stage.span;
+    const MyComplex<T>* twiddles = inverse ? stage.inverseTwiddles.data() : stage.twiddles.data();
+
+    for (int start = 0; start < n; start += radix * span) {
+        MyComplex<T>* group = a + start;
+        if (radix == 2) {
+            // The twiddle multiply is fused into the butterfly
+            if (kernels.butterfly && span > 1) {
+                kernels.butterfly(group, group + span, twiddles, span);
+            } else {
+                for (int k = 0; k < span; ++k) butterflyScalar(group[k], group[span + k], twiddles[k]);
+            }
+            continue;
+        }
+
+        if (span > 1) {
+            // The first stage has span 1, where every twiddle is 1
+            for (int j = 1; j < radix; ++j) {
+                MyComplex<T>* run = group + j * span;
+                const MyComplex<T>* w = twiddles + (j - 1) * span;
+                if (kernels.multiply) {
+                    kernels.multiply(run, w, span);
+                } else {
+                    for (int k = 0; k < span; ++k) run[k] = w[k] * run[k];
+                }
+            }
+        }
+
+        if (radix == 4) {
+            if (kernels.radix4 && span > 1) {
+                kernels.radix4(group, group + span, group + 2 * span, group + 3 * span, span, inverse);
+            } else {
+                for (int k = 0; k < span; ++k) {
+                    radix4Scalar(group[k], group[span + k], group[2 * span + k], group[3 * span + k], inverse);
+                }
+            }
+            continue;
+        }
 
-    displayFrequencyMagnitude(imageData); // Display FFT magnitude
+        MyComplex<T> x[largestRadix];
+        for (int k = 0; k < span; ++k) {
+            for (int j = 0; j < radix; ++j) x[j] = group[j * span + k];
+            oddRadixButterfly(x, stage, inverse);
+            for (int j = 0; j < radix; ++j) group[j * span + k] = x[j];
+        }
+    }
 }
 
-#ifndef TESTING
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <ImagePath1> <ImagePath2> ..." << std::endl;
-        return -1;
+template <typename T>
+void bluesteinFFT(MyComplex<T>* a, const FFTPlan<T>& plan, bool inverse) {
+    const int n = plan.n;
+    const FFTPlan<T>& convolution = *plan.convolutionPlan;
+    const vector<MyComplex<T>>& chirp = inverse ? plan.inverseChirp : plan.chirp;
+    const vector<MyComplex<T>>& filter = inverse ? plan.inverseChirpSpectrum : plan.chirpSpectrum;
+
+    static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> work;
+    work.assign(convolution.n, MyComplex<T>());
+    for (int j = 0; j < n; ++j) work[j] = a[j] * chirp[j];
+    fft(work.data(), convolution, false);
+    for (int k = 0; k < convolution.n; ++k) work[k] = work[k] * filter[k];
+    fft(work.data(), convolution, true);
+    for (int k = 0; k < n; ++k) a[k] = work[k] * chirp[k];
+}
+
+template <typename T>
+void fft(MyComplex<T>* a, const FFTPlan<T>& plan, bool inverse) {
+    const int n = plan.n;
+    if (n <= 1) return;
+
+    if (plan.bluestein) {
+        bluesteinFFT(a, plan, inverse);
+    } else {
+        if (plan.permutationSwaps) {
+            for (int i = 0; i < n; ++i) {
+                int j = plan.permutation[i];
+                if (i < j) std::swap(a[i], a[j]);
+            }
+        } else {
+            static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> reordered;
+            reordered.resize(n);
+            for (int i = 0; i < n; ++i) reordered[plan.permutation[i]] = a[i];
+            std::copy(reordered.begin(), reordered.begin() + n, a);
+        }
+
+        const FFTKernels<T>& kernels = getFFTKernels<T>();
+        for (const FFTStage<T>& stage : plan.stages) {
+            runStage(a, n, stage, inverse, kernels);
+        }
     }
 
-    for (int i = 1; i < argc; ++i) {
-        std::cout << "Processing: " << argv[i] << std::endl;
-        processSingleImage(argv[i]);
+    if (inverse) {
+        // One rounding of the exact quotient; for power-of-two n this is the exact halving of every stage
+        for (int i = 0; i < n; ++i) {
+            a[i].real = T(static_cast<double>(a[i].real) / n);
+            a[i].imag = T(static_cast<double>(a[i].imag) / n);
+        }
     }
+}
 
-    return 0;
+template <typename T>
+void fft(vector<MyComplex<T>>& a, bool inverse) {
+    const int n = a.size();
+    if (n <= 1) return;
+    fft(a.data(), getFFTPlan<T>(n), inverse);
+}
+
+bool isPowerOfTwo(int n) {
+    return (n & (n - 1)) == 0;
+}
+
+int nextPowerOfTwo(int n) {
+    if (n < 1) return 1;
+    int power = 1;
+    while (power < n) power <<= 1;
+    return power;
+}
+
+template <typename T>
+void saveFFTResults(const ComplexMatrix<T>& fftData, const std::string& filePath) {
+    ScopedTimer timer("output");
+    std::ofstream file(filePath);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing FFT results." << std::endl;
+        return;
+    }
+
+    // A half spectrum is written out in full, mirrored bins are rebuilt on the fly
+    const int width = fftData.logicalCols();
+    for (int y = 0; y < fftData.rows; ++y) {
+        for (int x = 0; x < width; ++x) {
+            MyComplex<T> val = fftData.at(y, x);
+            file << static_cast<double>(val.real) / fftData.scale << "," << static_cast<double>(val.imag) / fftData.scale << " ";
+        }
+        file << "\n";
+    }
+    fftCounters.bytesWritten.fetch_add(static_cast<long long>(file.tellp()), std::memory_order_relaxed);
+    file.close();
+}
+
+// Writes the .npy preamble and header of a C-order rows x cols array of descr
+void writeNpyHeader(std::ostream& file, const std::string& descr, int rows, int cols) {
+    std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" +
+                         std::to_string(rows) + ", " + std::to_string(cols) + "), }";
+    // Pad so the data starts on a 64 byte boundary: magic (6) + version (2) + length (2) + header + newline
+    const size_t unpadded = 10 + header.size() + 1;
+    header.append((64 - unpadded % 64) % 64, ' ');
+    header += '\n';
+
+    const unsigned short headerLength = static_cast<unsigned short>(header.size());
+    const char preamble[10] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                               static_cast<char>(headerLength & 0xFF), static_cast<char>(headerLength >> 8)};
+    file.write(preamble, sizeof(preamble));
+    file.write(header.data(), header.size());
+}
+
+// Spectra are written as NumPy .npy (format 1.0) so that Python can
+// np.load(path, mmap_mode='r') them without parsing or copying. The stored
+// values are the matrix as kept in memory (a half spectrum stays half), in
+// complex64 when the scalar format fits in a float and complex128 otherwise.
+// .npy headers cannot carry extra keys, so the spectrum layout and scalar
+// format go in a small JSON file next to it (path with .json instead of .npy).
+// Writes a spectrum as .npy one row at a time, so a spectrum that is never
+// held in memory as a whole (see streamSpectrum) is saved the same way.
+template <typename T>
+class NpySpectrumWriter {
+public:
+    NpySpectrumWriter() : buffer(1 << 20) {}
+
+    bool open(const std::string& filePath, int rows, int cols, double scale) {
+        path = filePath;
+        this->rows = rows;
+        this->cols = cols;
+        this->scale = scale;
+        file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        file.open(filePath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open file for writing FFT results." << std::endl;
+            return false;
+        }
+        writeNpyHeader(file, singlePrecision ? "<c8" : "<c16", rows, cols);
+        floats.resize(singlePrecision ? 2 * cols : 0);
+        doubles.resize(singlePrecision ? 0 : 2 * cols);
+        return true;
+    }
+
+    // Little-endian values, one write per row
+    void writeRow(const MyComplex<T>* row) {
+        if (singlePrecision) {
+            for (int x = 0; x < cols; ++x) {
+                floats[2 * x] = static_cast<float>(static_cast<double>(row[x].real) / scale);
+                floats[2 * x + 1] = static_cast<float>(static_cast<double>(row[x].imag) / scale);
+            }
+            file.write(reinterpret_cast<const char*>(floats.data()), floats.size() * sizeof(float));
+        } else {
+            for (int x = 0; x < cols; ++x) {
+                doubles[2 * x] = static_cast<double>(row[x].real) / scale;
+                doubles[2 * x + 1] = static_cast<double>(row[x].imag) / scale;
+            }
+            file.write(reinterpret_cast<const char*>(doubles.data()), doubles.size() * sizeof(double));
+        }
+    }
+
+    // Finishes the file and writes the .json next to it; fullCols is 0 for a full spectrum
+    bool close(int fullCols) {
+        const std::streamoff written = file.tellp();
+        file.close();
+        if (!file) {
+            std::cerr << "Failed to write FFT results: " << path << std::endl;
+            return false;
+        }
+        fftCounters.bytesWritten.fetch_add(static_cast<long long>(written), std::memory_order_relaxed);
+        std::ofstream meta(fs::path(path).replace_extension(".json"));
+        meta << "{\"rows\": " << rows << ", \"cols\": " << cols
+             << ", \"full_cols\": " << (fullCols > 0 ? fullCols : cols)
+             << ", \"half_spectrum\": " << (fullCols > 0 ? "true" : "false")
+             << ", \"exponent_bits\": " << ScalarTraits<T>::exponentBits
+             << ", \"significand_bits\": " << ScalarTraits<T>::significandBits
+             << ", \"dtype\": \"" << (singlePrecision ? "complex64" : "complex128") << "\"}\n";
+        return static_cast<bool>(meta);
+    }
+
+private:
+    // Every value of the scalar type is exact in a float
+    static constexpr bool singlePrecision = ScalarTraits<T>::exponentBits <= 8 && ScalarTraits<T>::significandBits <= 23;
+    vector<char> buffer;
+    std::ofstream file;
+    std::string path;
+    int rows = 0, cols = 0;
+    double scale = 1.0;
+    vector<float> floats;
+    vector<double> doubles;
+};
+
+template <typename T>
+bool saveFFTResultsNpy(const ComplexMatrix<T>& fftData, const std::string& filePath) {
+    ScopedTimer timer("output");
+    NpySpectrumWriter<T> writer;
+    if (!writer.open(filePath, fftData.rows, fftData.cols, fftData.scale)) return false;
+    for (int y = 0; y < fftData.rows; ++y) {
+        writer.writeRow(fftData.row(y));
+    }
+    return writer.close(fftData.fullCols);
+}
+
+// The blur map as float64 .npy, with the tile layout in a .json file next to it
+bool saveBlurMapNpy(const BlurMap& map, const std::string& filePath) {
+    ScopedTimer timer("output");
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing the blur map." << std::endl;
+        return false;
+    }
+    writeNpyHeader(file, "<f8", map.gridRows, map.gridCols);
+    file.write(reinterpret_cast<const char*>(map.scores.data()), map.scores.size() * sizeof(double));
+    const std::streamoff written = file.tellp();
+    file.close();
+    if (!file) {
+        std::cerr << "Failed to write blur map: " << filePath << std::endl;
+        return false;
+    }
+    fftCounters.bytesWritten.fetch_add(static_cast<long long>(written), std::memory_order_relaxed);
+
+    std::ofstream meta(fs::path(filePath).replace_extension(".json"));
+    meta << "{\"rows\": " << map.gridRows << ", \"cols\": " << map.gridCols
+         << ", \"tile\": " << map.tileSize << ", \"stride\": " << map.stride
+         << ", \"image_rows\": " << map.imageRows << ", \"image_cols\": " << map.imageCols
+         << ", \"cutoff\": " << map.cutoff << "}\n";
+    return static_cast<bool>(meta);
+}
+
+// Writes the transpose of a rows x cols block of src into dst, walking both
+// in small square tiles so that reads and writes stay within a few cache lines.
+template <typename T>
+void transposeBlock(const MyComplex<T>* src, size_t srcStride, MyComplex<T>* dst, size_t dstStride, int rows, int cols) {
+    const int tile = 8;
+    for (int y0 = 0; y0 < rows; y0 += tile) {
+        const int yEnd = min(y0 + tile, rows);
+        for (int x0 = 0; x0 < cols; x0 += tile) {
+            const int xEnd = min(x0 + tile, cols);
+            for (int y = y0; y < yEnd; ++y) {
+                for (int x = x0; x < xEnd; ++x) {
+                    dst[x * dstStride + y] = src[y * srcStride + x];
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+void fft2D(ComplexMatrix<T>& data, bool invert) {
+    const int rows = data.rows;
+    const int cols = data.cols;
+    ThreadPool& pool = getFFTThreadPool();
+
+    // Process the rows with FFT, a chunk of rows per task
+    {
+        ScopedTimer timer("row pass");
+        const FFTPlan<T>& rowPlan = getFFTPlan<T>(cols);
+        pool.parallelFor(0, rows, max(1, rows / (pool.size() * 8)), [&](int begin, int end) {
+            for (int y = begin; y < end; ++y) {
+                fft(data.row(y), rowPlan, invert);
+            }
+        });
+        fftCounters.transforms.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    fftColumns(data, invert);
+
+    // The inverse row and column transforms already scale by 1/cols and 1/rows
+}
+
+
+template <typename T>
+void fftColumns(ComplexMatrix<T>& data, bool invert) {
+    ScopedTimer timer("column pass");
+    fftColumnRange(data.row(0), data.stride, data.rows, 0, data.cols, invert);
+}
+
+template <typename T>
+void fftColumnRange(MyComplex<T>* data, size_t stride, int rows, int x0, int x1, bool invert) {
+    ThreadPool& pool = getFFTThreadPool();
+
+    // Process the columns a panel at a time: copy the panel out so each column
+    // is contiguous, transform it and copy it back. No full transpose is made.
+    const int panelWidth = 8;
+    const int panels = (x1 - x0 + panelWidth - 1) / panelWidth;
+    const FFTPlan<T>& columnPlan = getFFTPlan<T>(rows);
+    pool.parallelFor(0, panels, max(1, panels / (pool.size() * 8)), [&](int begin, int end) {
+        static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> panel;
+        panel.resize(size_t(panelWidth) * rows);
+        for (int p = begin; p < end; ++p) {
+            const int left = x0 + p * panelWidth;
+            const int width = min(panelWidth, x1 - left);
+            transposeBlock(data + left, stride, panel.data(), rows, rows, width);
+            for (int c = 0; c < width; ++c) {
+                fft(panel.data() + size_t(c) * rows, columnPlan, invert);
+            }
+            transposeBlock(panel.data(), rows, data + left, stride, width, rows);
+        }
+    });
+    fftCounters.transforms.fetch_add(x1 - x0, std::memory_order_relaxed);
+}
+
+// No bin of an n point transform can exceed n times the largest input value,
+// and no value inside it either, except in Bluestein's convolution: there the
+// input's spectrum is multiplied by the chirp filter's, which reaches 2n - 1.
+template <typename T>
+double transformGrowth(int n) {
+    return getFFTPlan<T>(n).convolutionPlan ? double(n) * (2 * n - 1) : double(n);
+}
+
+// Formats with the exponent range of float or more always have room for the
+// growth of a transform; fp16 overflows on the zero frequency of any sizeable
+// image, so its input is scaled down by a power of two (exact, and the
+// blurriness is a ratio so it does not change). The input goes through
+// transformRows x transformCols 2D transforms; the 2 allows for two inputs
+// packed as a + i b.
+template <typename T, typename Pixel>
+double inputScale(const Pixel* pixels, size_t step, int rows, int cols, int transformRows, int transformCols) {
+    if (ScalarTraits<T>::exponentBits >= 8) return 1.0;
+    double largest = 0.0;
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            largest = max(largest, std::fabs(static_cast<double>(pixels[size_t(y) * step + x])));
+        }
+    }
+    const double peak = 2.0 * largest * transformGrowth<T>(transformRows) * transformGrowth<T>(transformCols);
+    if (!(peak > 0)) return 1.0;
+    const int maxExponent = (1 << (ScalarTraits<T>::exponentBits - 1)) - 1;
+    return std::ldexp(1.0, -max(0, std::ilogb(peak) + 1 - maxExponent));
+}
+
+// Real input needs only half the work: two real rows a and b are transformed
+// together as z = a + i*b, and since A(k) = conj(A(n - k)) for real a,
+//   A(k) = (Z(k) + conj(Z(n - k))) / 2,  B(k) = (Z(k) - conj(Z(n - k))) / 2i.
+// Only the columns k <= n / 2 are kept, then the column pass runs on those.
+// rfftRows writes the half spectra of rows (times scale) to out, row y at
+// out + y * outStride.
+template <typename T, typename Pixel>
+void rfftRows(const Pixel* pixels, size_t step, int rows, int cols, double scale, MyComplex<T>* out, size_t outStride) {
+    const int halfCols = cols / 2 + 1;
+    ThreadPool& pool = getFFTThreadPool();
+    const int pairs = (rows + 1) / 2;
+    const FFTPlan<T>& rowPlan = getFFTPlan<T>(cols);
+    const T half = T(0.5);
+    pool.parallelFor(0, pairs, max(1, pairs / (pool.size() * 8)), [&](int begin, int end) {
+        static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> packed;
+        packed.resize(cols);
+        for (int p = begin; p < end; ++p) {
+            const int y = 2 * p;
+            const bool hasPair = y + 1 < rows;
+            const Pixel* a = pixels + y * step;
+            const Pixel* b = hasPair ? a + step : nullptr;
+            for (int x = 0; x < cols; ++x) {
+                packed[x] = MyComplex<T>(T(scale * a[x]), T(hasPair ? scale * b[x] : 0.0));
+            }
+            fft(packed.data(), rowPlan, false);
+
+            MyComplex<T>* outA = out + size_t(y) * outStride;
+            MyComplex<T>* outB = hasPair ? outA + outStride : nullptr;
+            for (int k = 0; k < halfCols; ++k) {
+                MyComplex<T> zk = packed[k];
+                MyComplex<T> zc = packed[(cols - k) % cols].conj();
+                MyComplex<T> sum = zk + zc;
+                outA[k] = MyComplex<T>(sum.real * half, sum.imag * half);
+                if (outB) {
+                    MyComplex<T> diff = zk - zc;
+                    outB[k] = MyComplex<T>(diff.imag * half, -(diff.real * half));
+                }
+            }
+        }
+    });
+    fftCounters.transforms.fetch_add(pairs, std::memory_order_relaxed);
+}
+
+template <typename T, typename Pixel>
+void rfft2DRows(const Pixel* pixels, size_t step, int rows, int cols, ComplexMatrix<T>& spectrum) {
+    const int halfCols = cols / 2 + 1;
+    spectrum.resize(rows, halfCols);
+    spectrum.fullCols = cols;
+    spectrum.scale = inputScale<T>(pixels, step, rows, cols, rows, cols);
+    ScopedTimer timer("row pass");
+    rfftRows(pixels, step, rows, cols, spectrum.scale, spectrum.row(0), spectrum.stride);
+}
+
+template <typename T, typename Pixel>
+void rfft2D(const Pixel* pixels, size_t step, int rows, int cols, ComplexMatrix<T>& spectrum) {
+    rfft2DRows(pixels, step, rows, cols, spectrum);
+    fftColumns(spectrum, false);
+}
+
+template <typename T>
+void rfft2D(const Mat& img, ComplexMatrix<T>& spectrum) {
+    rfft2D(img.ptr<uchar>(0), img.step / sizeof(uchar), img.rows, img.cols, spectrum);
+}
+
+// Blurriness is the share of the spectrum's magnitude held by high frequencies.
+// A bin (y, x) of a rows x cols spectrum has normalized frequencies
+//   fy = min(y, rows - y) / rows,  fx = min(x, cols - x) / cols,
+// both in [0, 0.5] (the absolute value of numpy.fft.fftfreq), and is high
+// frequency when max(fy, fx) > cutoff. The ratio runs from 0 to 1 and a lower
+// ratio means a blurrier image. Since it is defined on normalized frequency it
+// does not depend on the image size, so reduced decodes score comparably.
+// main.py's calculate_blurriness_ratio computes the same number.
+vector<char> highFrequencyBins(int n, double cutoff) {
+    vector<char> high(n);
+    for (int k = 0; k < n; ++k) {
+        high[k] = static_cast<double>(min(k, n - k)) / n > cutoff;
+    }
+    return high;
+}
+
+template <typename T>
+inline double binMagnitude(const MyComplex<T>& value) {
+    const double re = static_cast<double>(value.real);
+    const double im = static_cast<double>(value.imag);
+    return std::sqrt(re * re + im * im);
+}
+
+// The sums behind calculateBlurriness, fed one stored spectrum row at a time
+// (in row order, so the result does not depend on how the rows arrive).
+// Accumulated in double: a FloatX sum stops growing long before it has seen every bin.
+struct BlurrinessSums {
+    vector<char> highRow, highCol;
+    vector<double> weight; // multiplicity of each stored column
+    double totalEnergy = 0.0;
+    double highFreqEnergy = 0.0;
+
+    // fullCols is the width of the real input of a half spectrum, 0 for a full spectrum of cols columns
+    BlurrinessSums(int rows, int cols, int fullCols, double cutoff)
+        : highRow(highFrequencyBins(rows, cutoff)), highCol(highFrequencyBins(fullCols > 0 ? fullCols : cols, cutoff)), weight(cols) {
+        for (int x = 0; x < cols; ++x) {
+            // A half spectrum also stands for the mirrored bin (-y, -x), which
+            // has the same magnitude and the same |fy| and |fx|
+            weight[x] = fullCols > 0 && x > 0 && 2 * x != fullCols ? 2 : 1;
+        }
+    }
+
+    template <typename T>
+    void addRow(int y, const MyComplex<T>* row) {
+        double rowTotal = 0.0, rowHigh = 0.0;
+        for (size_t x = 0; x < weight.size(); ++x) {
+            double magnitude = binMagnitude(row[x]) * weight[x];
+            rowTotal += magnitude;
+            if (highRow[y] || highCol[x]) {
+                rowHigh += magnitude;
+            }
+        }
+        totalEnergy += rowTotal;
+        highFreqEnergy += rowHigh;
+    }
+
+    double ratio() const {
+        return highFreqEnergy / totalEnergy; // Lower ratio indicates a blurrier image
+    }
+};
+
+template <typename T>
+double calculateBlurriness(const ComplexMatrix<T>& freqDomain, double cutoff) {
+    ScopedTimer timer("metric");
+    BlurrinessSums sums(freqDomain.rows, freqDomain.cols, freqDomain.fullCols, cutoff);
+    for (int y = 0; y < freqDomain.rows; ++y) {
+        sums.addRow(y, freqDomain.row(y));
+    }
+    return sums.ratio();
+}
+
+// calculateBlurriness(rfft2D(image)) without storing the spectrum: the row
+// pass is kept as usual, but every column is reduced to its energy sums right
+// after its FFT instead of being written back. Per-panel sums are added in
+// panel order, so the result does not depend on the thread count.
+template <typename T, typename Pixel>
+double blurScore(const Pixel* pixels, size_t step, int rows, int cols, double cutoff) {
+    static thread_local ComplexMatrix<T> rowPassBuffer; // Kept between calls, images tend to repeat sizes
+    // Captured by reference below: naming the thread_local inside the lambda
+    // would give each pool worker its own, empty, buffer
+    ComplexMatrix<T>& rowPass = rowPassBuffer;
+    rfft2DRows(pixels, step, rows, cols, rowPass);
+
+    const vector<char> highRow = highFrequencyBins(rows, cutoff);
+    const vector<char> highCol = highFrequencyBins(cols, cutoff);
+    const int halfCols = rowPass.cols;
+    const int panelWidth = 8;
+    const int panels = (halfCols + panelWidth - 1) / panelWidth;
+    vector<double> panelTotal(panels), panelHigh(panels);
+
+    ScopedTimer timer("column pass and metric");
+    ThreadPool& pool = getFFTThreadPool();
+    const FFTPlan<T>& columnPlan = getFFTPlan<T>(rows);
+    pool.parallelFor(0, panels, max(1, panels / (pool.size() * 8)), [&](int begin, int end) {
+        static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> panel;
+        panel.resize(size_t(panelWidth) * rows);
+        for (int p = begin; p < end; ++p) {
+            const int x0 = p * panelWidth;
+            const int width = min(panelWidth, halfCols - x0);
+            transposeBlock(rowPass.row(0) + x0, rowPass.stride, panel.data(), rows, rows, width);
+            double total = 0.0, high = 0.0;
+            for (int c = 0; c < width; ++c) {
+                const int x = x0 + c;
+                MyComplex<T>* column = panel.data() + size_t(c) * rows;
+                fft(column, columnPlan, false);
+                const double weight = rowPass.multiplicity(x);
+                for (int y = 0; y < rows; ++y) {
+                    double magnitude = binMagnitude(column[y]) * weight;
+                    total += magnitude;
+                    if (highRow[y] || highCol[x]) {
+                        high += magnitude;
+                    }
+                }
+            }
+            panelTotal[p] = total;
+            panelHigh[p] = high;
+        }
+    });
+    fftCounters.transforms.fetch_add(halfCols, std::memory_order_relaxed);
+
+    double totalEnergy = 0.0, highFreqEnergy = 0.0;
+    for (int p = 0; p < panels; ++p) {
+        totalEnergy += panelTotal[p];
+        highFreqEnergy += panelHigh[p];
+    }
+    return highFreqEnergy / totalEnergy;
+}
+
+template <typename T>
+double blurScore(const Mat& img, double cutoff) {
+    return blurScore<T>(img.ptr<uchar>(0), img.step / sizeof(uchar), img.rows, img.cols, cutoff);
+}
+
+// Decoding at reduced size lets the JPEG decoder skip most of its work, which
+// matters more than the FFT for large photos when only the score is wanted
+int grayscaleReadFlag(int reduce) {
+    switch (reduce) {
+        case 2: return IMREAD_REDUCED_GRAYSCALE_2;
+        case 4: return IMREAD_REDUCED_GRAYSCALE_4;
+        case 8: return IMREAD_REDUCED_GRAYSCALE_8;
+        default: return IMREAD_GRAYSCALE;
+    }
+}
+
+// All tiles share one plan and run as a batch on the thread pool, two at a
+// time: tiles a and b go in as the real and imaginary parts of z = a + i*b, and
+// after one complex 2D FFT their spectra are separated with
+//   A(k) = (Z(k) + conj(Z(-k))) / 2,  B(k) = (Z(k) - conj(Z(-k))) / 2i.
+// Each worker keeps its tile buffers in a thread_local arena. The Hann window
+// keeps the tile edges from showing up as high frequency detail.
+template <typename T, typename Pixel>
+void computeBlurMap(const Pixel* pixels, size_t step, int rows, int cols, int tileSize, double cutoff, BlurMap& map) {
+    ScopedTimer timer("blur map");
+    const int tile = min(tileSize, min(rows, cols));
+    map.tileSize = tile;
+    map.stride = max(1, tile / 2);
+    map.imageRows = rows;
+    map.imageCols = cols;
+    map.cutoff = cutoff;
+    map.gridRows = (rows - tile + map.stride - 1) / map.stride + 1;
+    map.gridCols = (cols - tile + map.stride - 1) / map.stride + 1;
+    map.scores.assign(size_t(map.gridRows) * map.gridCols, 0.0);
+
+    vector<double> window(tile);
+    for (int i = 0; i < tile; ++i) {
+        window[i] = 0.5 - 0.5 * cos(2 * PI * i / tile);
+    }
+    const vector<char> high = highFrequencyBins(tile, cutoff);
+    const FFTPlan<T>& plan = getFFTPlan<T>(tile);
+    const double scale = inputScale<T>(pixels, step, rows, cols, tile, tile);
+    const size_t area = size_t(tile) * tile;
+    const int tiles = map.gridRows * map.gridCols;
+    const int pairs = (tiles + 1) / 2;
+
+    ThreadPool& pool = getFFTThreadPool();
+    pool.parallelFor(0, pairs, max(1, pairs / (pool.size() * 8)), [&](int begin, int end) {
+        static thread_local vector<MyComplex<T>, AlignedAllocator<MyComplex<T>>> arena;
+        arena.resize(2 * area);
+        MyComplex<T>* z = arena.data();
+        MyComplex<T>* columns = arena.data() + area;
+
+        for (int p = begin; p < end; ++p) {
+            const int t[2] = {2 * p, 2 * p + 1};
+            const bool hasPair = t[1] < tiles;
+            const Pixel* a = pixels + size_t(map.tileTop(t[0] / map.gridCols)) * step + map.tileLeft(t[0] % map.gridCols);
+            const Pixel* b = hasPair ? pixels + size_t(map.tileTop(t[1] / map.gridCols)) * step + map.tileLeft(t[1] % map.gridCols) : nullptr;
+            for (int y = 0; y < tile; ++y) {
+                MyComplex<T>* out = z + size_t(y) * tile;
+                for (int x = 0; x < tile; ++x) {
+                    const double w = scale * window[y] * window[x];
+                    out[x] = MyComplex<T>(T(w * a[size_t(y) * step + x]), T(hasPair ? w * b[size_t(y) * step + x] : 0.0));
+                }
+            }
+
+            for (int y = 0; y < tile; ++y) {
+                fft(z + size_t(y) * tile, plan, false);
+            }
+            transposeBlock(z, tile, columns, tile, tile, tile);
+            for (int x = 0; x < tile; ++x) {
+                fft(columns + size_t(x) * tile, plan, false);
+            }
+
+            // columns holds the spectrum transposed; the metric is symmetric in fy and fx
+            double total[2] = {0.0, 0.0}, highEnergy[2] = {0.0, 0.0};
+            for (int u = 0; u < tile; ++u) {
+                const MyComplex<T>* row = columns + size_t(u) * tile;
+                const MyComplex<T>* mirroredRow = columns + size_t((tile - u) % tile) * tile;
+                for (int v = 0; v < tile; ++v) {
+                    const MyComplex<T>& zk = row[v];
+                    const MyComplex<T>& zm = mirroredRow[(tile - v) % tile];
+                    const double zr = static_cast<double>(zk.real), zi = static_cast<double>(zk.imag);
+                    const double mr = static_cast<double>(zm.real), mi = static_cast<double>(zm.imag);
+                    const double magnitude[2] = {0.5 * std::hypot(zr + mr, zi - mi), 0.5 * std::hypot(zr - mr, zi + mi)};
+                    const bool isHigh = high[u] || high[v];
+                    for (int k = 0; k < 2; ++k) {
+                        total[k] += magnitude[k];
+                        if (isHigh) highEnergy[k] += magnitude[k];
+                    }
+                }
+            }
+            for (int k = 0; k < (hasPair ? 2 : 1); ++k) {
+                // A flat tile has no detail at all
+                map.scores[t[k]] = total[k] > 0 ? highEnergy[k] / total[k] : 0.0;
+            }
+        }
+    });
+    fftCounters.transforms.fetch_add(2LL * pairs * tile, std::memory_order_relaxed);
+}
+
+template <typename T>
+void computeBlurMap(const Mat& img, int tileSize, double cutoff, BlurMap& map) {
+    computeBlurMap<T>(img.ptr<uchar>(0), img.step / sizeof(uchar), img.rows, img.cols, tileSize, cutoff, map);
+}
+
+
+template <typename T>
+bool spectrumExceedsBudget(int rows, int cols, const ProcessOptions& options) {
+    return options.memoryBudget > 0 && size_t(rows) * (cols / 2 + 1) * sizeof(MyComplex<T>) > options.memoryBudget;
+}
+
+#ifdef FFT_MAPPED_SCRATCH
+// count values of MyComplex<T> in a memory-mapped scratch file. The file is
+// unlinked as soon as it is created, so it goes away with the process however
+// that ends. Ranges handed back with release() stay in the file but leave this
+// process's memory; touching them again reads them back in.
+template <typename T>
+class ScratchBuffer {
+public:
+    typedef MyComplex<T> Complex;
+
+    ScratchBuffer() {}
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+    ~ScratchBuffer() {
+        if (mapping) ::munmap(mapping, bytes);
+    }
+
+    bool create(const std::string& directory, size_t count, std::string& error) {
+        bytes = max<size_t>(count, 1) * sizeof(Complex);
+        std::string pattern = ((directory.empty() ? fs::temp_directory_path() : fs::path(directory)) / "newfft-scratch-XXXXXX").string();
+        vector<char> name(pattern.begin(), pattern.end());
+        name.push_back('\0');
+        int fd = ::mkstemp(name.data());
+        if (fd < 0) {
+            error = "cannot create a scratch file like " + pattern + ": " + std::strerror(errno);
+            return false;
+        }
+        ::unlink(name.data());
+        void* address = MAP_FAILED;
+        if (::ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+            address = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (address == MAP_FAILED) {
+            error = std::string("cannot map a scratch file of ") + std::to_string(bytes) + " bytes: " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        ::close(fd); // The mapping keeps the file
+        mapping = static_cast<Complex*>(address);
+        return true;
+    }
+
+    Complex* data() { return mapping; }
+
+    // Drops the whole pages within [begin, end) from memory. The mapping is
+    // shared, so their contents stay in the file (and the page cache).
+    void release(const Complex* begin, const Complex* end) {
+        const uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+        const uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page - 1) / page * page;
+        const uintptr_t last = reinterpret_cast<uintptr_t>(end) / page * page;
+        if (last > first) {
+            ::madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+        }
+    }
+
+private:
+    Complex* mapping = nullptr;
+    size_t bytes = 0;
+};
+#endif
+
+// rfft2D, calculateBlurriness and saveFFTResultsNpy of an image whose spectrum
+// is larger than options.memoryBudget. The spectrum lives in a ScratchBuffer
+// as a row of column panels, each panel one contiguous rows x width block:
+//   1. the row pass runs in horizontal strips into a strip buffer, which is
+//      then split across the panels and released to the file;
+//   2. the column pass transforms one panel at a time (the four-step scheme:
+//      with the panels laid out this way no pass ever walks the file with a
+//      stride), releasing each panel when it is done;
+//   3. one more pass gathers the strips back to add up the blurriness and
+//      write the .npy.
+// Half the budget goes to the strip buffer and half to the panel in use, so
+// memory use is the decoded image plus about the budget whatever the image
+// size. Rows are paired and columns transformed exactly as in rfft2D, so the
+// spectrum, the blurriness and the saved file match the in-memory path bit
+// for bit. npyPath may be empty to only compute the blurriness.
+template <typename T, typename Pixel>
+bool streamSpectrum(const Pixel* pixels, size_t step, int rows, int cols, const ProcessOptions& options, const std::string& npyPath,
+                    double& blurriness, std::string& error) {
+#ifdef FFT_MAPPED_SCRATCH
+    typedef MyComplex<T> Complex;
+    const int halfCols = cols / 2 + 1;
+    const size_t share = max<size_t>(options.memoryBudget / 2, 1);
+    // Strips of an even number of rows keep the row pairs of rfft2D
+    const int stripRows = static_cast<int>(min<size_t>(rows, max<size_t>(2, share / (halfCols * sizeof(Complex)) / 2 * 2)));
+    const int panelCols = static_cast<int>(min<size_t>(halfCols, max<size_t>(8, share / (size_t(rows) * sizeof(Complex)) / 8 * 8)));
+
+    ScratchBuffer<T> scratch;
+    if (!scratch.create(options.scratchDirectory, size_t(rows) * halfCols, error)) return false;
+    // Every panel before column x0 is panelCols wide, so the panel at x0 starts rows * x0 values in
+    auto panel = [&](int x0) { return scratch.data() + size_t(rows) * x0; };
+    auto panelWidth = [&](int x0) { return min(panelCols, halfCols - x0); };
+    ComplexMatrix<T> strip(stripRows, halfCols);
+
+    const double scale = inputScale<T>(pixels, step, rows, cols, rows, cols);
+    {
+        ScopedTimer timer("row pass");
+        for (int y0 = 0; y0 < rows; y0 += stripRows) {
+            const int count = min(stripRows, rows - y0);
+            rfftRows(pixels + size_t(y0) * step, step, count, cols, scale, strip.row(0), strip.stride);
+            for (int x0 = 0; x0 < halfCols; x0 += panelCols) {
+                const int width = panelWidth(x0);
+                Complex* block = panel(x0) + size_t(y0) * width;
+                for (int y = 0; y < count; ++y) {
+                    std::memcpy(block + size_t(y) * width, strip.row(y) + x0, width * sizeof(Complex));
+                }
+                scratch.release(block, block + size_t(count) * width);
+            }
+        }
+    }
+
+    {
+        ScopedTimer timer("column pass");
+        for (int x0 = 0; x0 < halfCols; x0 += panelCols) {
+            const int width = panelWidth(x0);
+            fftColumnRange(panel(x0), width, rows, 0, width, false);
+            scratch.release(panel(x0), panel(x0) + size_t(rows) * width);
+        }
+    }
+
+    // The metric and the .npy are fed row by row in one pass, timed together
+    ScopedTimer timer("metric and output");
+    BlurrinessSums sums(rows, halfCols, cols, options.cutoff);
+    NpySpectrumWriter<T> writer;
+    if (!npyPath.empty() && !writer.open(npyPath, rows, halfCols, scale)) {
+        error = "failed to open " + npyPath;
+        return false;
+    }
+    for (int y0 = 0; y0 < rows; y0 += stripRows) {
+        const int count = min(stripRows, rows - y0);
+        for (int x0 = 0; x0 < halfCols; x0 += panelCols) {
+            const int width = panelWidth(x0);
+            const Complex* block = panel(x0) + size_t(y0) * width;
+            for (int y = 0; y < count; ++y) {
+                std::memcpy(strip.row(y) + x0, block + size_t(y) * width, width * sizeof(Complex));
+            }
+            scratch.release(block, block + size_t(count) * width);
+        }
+        for (int y = 0; y < count; ++y) {
+            sums.addRow(y0 + y, strip.row(y));
+            if (!npyPath.empty()) writer.writeRow(strip.row(y));
+        }
+    }
+    if (!npyPath.empty() && !writer.close(cols)) {
+        error = "failed to save spectrum";
+        return false;
+    }
+    blurriness = sums.ratio();
+    return true;
+#else
+    error = "streaming needs memory-mapped files, which this platform does not have";
+    return false;
+#endif
+}
+
+template <typename T>
+void displayFrequencyMagnitude(const ComplexMatrix<T>& freqDomain) {
+    int height = freqDomain.rows;
+    int width = freqDomain.logicalCols();
+    Mat magnitudeImage = Mat::zeros(height, width, CV_32F);
+    
+    for (int y = 0; y < height; ++y) {
+        const MyComplex<T>* row = freqDomain.row(y);
+        float* out = magnitudeImage.ptr<float>(y);
+        for (int x = 0; x < freqDomain.cols; ++x) {
+            // Use the abs() method from MyComplex to calculate magnitude
+            float magnitude = row[x].abs();
+            out[x] = magnitude;
+            if (freqDomain.multiplicity(x) == 2) {
+                magnitudeImage.at<float>((height - y) % height, width - x) = magnitude;
+            }
+        }
+    }
+
+    magnitudeImage += Scalar::all(1); // Avoid log(0)
+    log(magnitudeImage, magnitudeImage);
+
+    // Shift the zero-frequency component to the center
+    shiftDFT(magnitudeImage);
+
+    // Normalize the magnitude to a range [0, 1] for display purposes
+    normalize(magnitudeImage, magnitudeImage, 0, 1, NORM_MINMAX);
+
+    // Display the dynamic range for diagnostic purposes
+    double minVal, maxVal;
+    minMaxLoc(magnitudeImage, &minVal, &maxVal);
+    cout << "Dynamic Range - MinVal: " << minVal << ", MaxVal: " << maxVal << endl;
+
+    // Resize the image for better viewing if it's too large
+    double maxDimension = 800; // Maximum size of the window for either width or height
+    double scale = min(maxDimension / magnitudeImage.cols, maxDimension / magnitudeImage.rows);
+    Mat resizedMagnitudeImage;
+    resize(magnitudeImage, resizedMagnitudeImage, Size(), scale, scale, INTER_LINEAR);
+
+    // Display the resized frequency magnitude image
+    imshow("Frequency Magnitude", resizedMagnitudeImage);
+    waitKey(0);
+}
+
+
+template <typename T>
+void processSingleImage(const std::string& inputPath, const Mat& img, const ProcessOptions& options) {
+    // Construct the expected results file path
+    std::string fftResultsFilePath = inputPath + (options.writeCsv ? "_fft_results.csv" : "_fft_results.npy");
+
+    if (options.blurMapTile > 0) {
+        BlurMap map;
+        computeBlurMap<T>(img, options.blurMapTile, options.cutoff, map);
+        std::string blurMapPath = inputPath + "_blur_map.npy";
+        if (saveBlurMapNpy(map, blurMapPath)) {
+            std::cout << "Blur map: " << map.gridRows << " x " << map.gridCols << " tiles of " << map.tileSize
+                      << " pixels saved to " << blurMapPath << std::endl;
+        }
+    }
+
+    if (spectrumExceedsBudget<T>(img.rows, img.cols, options)) {
+        // Too large to hold: the spectrum only ever exists in a scratch file, and nothing is displayed
+        std::string error;
+        double blurriness;
+        const std::string npyPath = options.saveSpectrum && !options.scoreOnly ? fftResultsFilePath : "";
+        if (!streamSpectrum<T>(img.ptr<uchar>(0), img.step / sizeof(uchar), img.rows, img.cols, options, npyPath, blurriness, error)) {
+            std::cerr << "Streaming FFT failed: " << error << std::endl;
+            return;
+        }
+        std::cout << "Blurriness: " << blurriness << std::endl;
+        return;
+    }
+
+    if (options.scoreOnly) {
+        double blurriness = blurScore<T>(img, options.cutoff);
+        std::cout << "Blurriness: " << blurriness << std::endl;
+        return;
+    }
+
+    if (!options.headless) {
+        imshow("Original Image", img);
+        waitKey(0);
+    }
+
+    // The image is real, so only the non-redundant half of its spectrum is computed and kept
+    ComplexMatrix<T> imageData;
+    rfft2D(img, imageData); // Perform FFT
+    if (options.saveSpectrum) {
+        if (options.writeCsv) {
+            saveFFTResults(imageData, fftResultsFilePath); // Save FFT results
+        } else {
+            saveFFTResultsNpy(imageData, fftResultsFilePath);
+        }
+    }
+    
+    double blurriness = calculateBlurriness(imageData, options.cutoff);
+    std::cout << "Blurriness: " << blurriness << std::endl;
+
+    if (!options.headless) {
+        displayFrequencyMagnitude(imageData); // Display FFT magnitude
+    }
+}
+
+void processSingleImage(const std::string& inputPath, const ProcessOptions& options) {
+    ScopedTimer timer("image", inputPath);
+    // Remove results left by an earlier run, in either format, so they cannot be mistaken for this one
+    for (const char* suffix : {"_fft_results.csv", "_fft_results.npy", "_fft_results.json", "_blur_map.npy", "_blur_map.json"}) {
+        std::string oldPath = inputPath + suffix;
+        if (fs::exists(oldPath)) {
+            fs::remove(oldPath);
+            std::cout << "Existing FFT results file removed: " << oldPath << std::endl;
+        }
+    }
+
+    Mat img;
+    {
+        ScopedTimer decodeTimer("decode");
+        img = imread(inputPath, grayscaleReadFlag(options.reduce));
+    }
+    if (img.empty()) {
+        std::cerr << "Error loading image: " << inputPath << std::endl;
+        return;
+    }
+
+    dispatchPrecision(options.precision, [&](auto tag) {
+        processSingleImage<typename decltype(tag)::type>(inputPath, img, options);
+    });
+    fftTracer.sampleCounters();
+}
+
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs the FFT and metric on an already decoded 8-bit grayscale image in the
+// scalar type T. spectrum is reused between calls, so a server working through
+// images of one size does not reallocate it. resultsBase is the image path the spectrum
+// is saved next to (empty to skip saving). When the spectrum is not saved the
+// fused blurScore is used, and the metric time is part of fftMs. A spectrum
+// over options.memoryBudget is streamed, and fftMs then covers the metric and
+// the save as well.
+template <typename T>
+ImageReport analyzeImage(const Mat& img, ComplexMatrix<T>& spectrum, const std::string& resultsBase, const ProcessOptions& options) {
+    ImageReport report;
+    report.rows = img.rows;
+    report.cols = img.cols;
+
+    const bool keepSpectrum = options.saveSpectrum && !options.scoreOnly && !resultsBase.empty();
+    auto start = std::chrono::steady_clock::now();
+    if (spectrumExceedsBudget<T>(img.rows, img.cols, options)) {
+        report.ok = streamSpectrum<T>(img.ptr<uchar>(0), img.step / sizeof(uchar), img.rows, img.cols, options,
+                                      keepSpectrum ? resultsBase + "_fft_results.npy" : "", report.blurriness, report.error);
+        report.fftMs = millisecondsSince(start);
+        return report;
+    }
+    if (!keepSpectrum) {
+        report.blurriness = blurScore<T>(img, options.cutoff);
+        report.fftMs = millisecondsSince(start);
+        report.ok = true;
+        return report;
+    }
+    rfft2D(img, spectrum);
+    report.fftMs = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    report.blurriness = calculateBlurriness(spectrum, options.cutoff);
+    report.metricMs = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    bool saved;
+    if (options.writeCsv) {
+        saveFFTResults(spectrum, resultsBase + "_fft_results.csv");
+        saved = true;
+    } else {
+        saved = saveFFTResultsNpy(spectrum, resultsBase + "_fft_results.npy");
+    }
+    report.saveMs = millisecondsSince(start);
+    if (!saved) {
+        report.error = "failed to save spectrum";
+        return report;
+    }
+
+    report.ok = true;
+    return report;
+}
+
+// analyzeImage in options.precision, with one spectrum buffer per format and thread
+ImageReport analyzeImage(const Mat& img, const std::string& resultsBase, const ProcessOptions& options) {
+    return dispatchPrecision(options.precision, [&](auto tag) {
+        typedef typename decltype(tag)::type T;
+        static thread_local ComplexMatrix<T> spectrum;
+        return analyzeImage(img, spectrum, resultsBase, options);
+    });
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+std::string imageReportJson(const std::string& id, const ImageReport& report) {
+    std::ostringstream json;
+    json << "{\"id\": \"" << jsonEscape(id) << "\", \"ok\": " << (report.ok ? "true" : "false");
+    if (!report.ok) {
+        json << ", \"error\": \"" << jsonEscape(report.error) << "\"";
+    }
+    json << ", \"rows\": " << report.rows << ", \"cols\": " << report.cols;
+    if (report.ok) {
+        json.precision(9);
+        // A blank image has no energy and so no ratio; JSON has no NaN
+        json << ", \"blurriness\": ";
+        if (std::isfinite(report.blurriness)) json << report.blurriness;
+        else json << "null";
+    }
+    json.precision(4);
+    json << std::fixed << ", \"decode_ms\": " << report.decodeMs << ", \"fft_ms\": " << report.fftMs
+         << ", \"metric_ms\": " << report.metricMs << ", \"save_ms\": " << report.saveMs
+         << ", \"total_ms\": " << report.totalMs << "}";
+    return json.str();
+}
+
+// Headless request loop. Every request gets exactly one JSON line back.
+//   <path>                       decode the image file at path
+//   frame <rows> <cols>          followed by rows * cols bytes of 8-bit grayscale pixels
+//   quit                         end the session
+// Only a line that is exactly "frame" and two integers is a frame, so a file
+// such as "frame 01.png" is still read as a path.
+// Plans, the thread pool and the spectrum buffer stay alive between requests.
+int serveRequests(std::istream& in, std::ostream& out, const ProcessOptions& options) {
+    Mat frame;
+    int frames = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        if (line == "quit") break;
+
+        auto start = std::chrono::steady_clock::now();
+        ScopedTimer timer("image", line);
+        ImageReport report;
+        std::string id = line;
+        std::string resultsBase;
+        Mat img;
+
+        std::istringstream words(line);
+        std::string command;
+        int rows = 0, cols = 0;
+        if (words >> command >> rows >> cols && command == "frame" && (words >> std::ws).eof()) {
+            id = "frame " + std::to_string(frames++);
+            if (rows <= 0 || cols <= 0) {
+                report.error = "expected: frame <rows> <cols> with positive sizes";
+                out << imageReportJson(id, report) << std::endl;
+                continue;
+            }
+            frame.create(rows, cols, CV_8UC1);
+            if (!in.read(reinterpret_cast<char*>(frame.data), std::streamsize(rows) * cols)) {
+                report.error = "frame data ended early";
+                out << imageReportJson(id, report) << std::endl;
+                break;
+            }
+            img = frame;
+        } else {
+            ScopedTimer decodeTimer("decode");
+            img = imread(line, grayscaleReadFlag(options.reduce));
+            resultsBase = line;
+            if (img.empty()) {
+                report.error = "could not load image";
+            }
+        }
+        report.decodeMs = millisecondsSince(start);
+
+        if (!img.empty()) {
+            double decodeMs = report.decodeMs;
+            report = analyzeImage(img, resultsBase, options);
+            report.decodeMs = decodeMs;
+        }
+        report.totalMs = millisecondsSince(start);
+        out << imageReportJson(id, report) << std::endl;
+        fftTracer.sampleCounters();
+    }
+    return 0;
+}
+
+// Chrome trace event format, which chrome://tracing and ui.perfetto.dev open:
+// every span is a complete ("X") event on the thread that ran it and the
+// counter samples are counter ("C") events.
+bool writeTrace(const std::string& path) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open trace file: " << path << std::endl;
+        return false;
+    }
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"NewFFT\"}}";
+    char times[64];
+    for (const auto& thread : fftTracer.threads()) {
+        file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->thread
+             << ", \"args\": {\"name\": \"" << (thread->thread == 0 ? "main" : "worker " + std::to_string(thread->thread)) << "\"}}";
+        for (const TraceEvent& event : thread->events) {
+            std::snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", event.start, event.duration);
+            file << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"fft\", \"ph\": \"X\", " << times
+                 << ", \"pid\": 1, \"tid\": " << thread->thread;
+            if (!event.detail.empty()) file << ", \"args\": {\"detail\": \"" << jsonEscape(event.detail) << "\"}";
+            file << "}";
+        }
+    }
+    for (const CounterSample& sample : fftTracer.counterSamples()) {
+        std::snprintf(times, sizeof(times), "\"ts\": %.3f", sample.time);
+        file << ",\n{\"name\": \"counters\", \"ph\": \"C\", " << times << ", \"pid\": 1, \"args\": {\"transforms\": "
+             << sample.transforms << ", \"bytes_written\": " << sample.bytesWritten << ", \"allocations\": " << sample.allocations << "}}";
+    }
+    file << "\n]}\n";
+    file.close();
+    if (!file) {
+        std::cerr << "Failed to write trace file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Spans of the same name are added up across threads, so a stage run in
+// parallel can show more time than the wall clock
+void printMetrics(std::ostream& out) {
+    vector<std::string> order;
+    std::map<std::string, std::pair<long long, double>> stages; // calls and microseconds per stage
+    for (const auto& thread : fftTracer.threads()) {
+        for (const TraceEvent& event : thread->events) {
+            auto& stage = stages[event.name];
+            if (stage.first++ == 0) order.push_back(event.name);
+            stage.second += event.duration;
+        }
+    }
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-24s %10s %12s\n", "stage", "calls", "total ms");
+    out << line;
+    for (const std::string& name : order) {
+        std::snprintf(line, sizeof(line), "%-24s %10lld %12.3f\n", name.c_str(), stages[name].first, stages[name].second / 1000.0);
+        out << line;
+    }
+    out << "transforms: " << fftCounters.transforms.load() << ", bytes written: " << fftCounters.bytesWritten.load()
+        << ", allocations: " << fftCounters.allocations.load() << std::endl;
+}
+
+#ifdef FFT_UNIX_SOCKETS
+// Minimal stream buffer over a socket, so serveRequests can talk to it like stdin/stdout
+class SocketStreamBuf : public std::streambuf {
+public:
+    explicit SocketStreamBuf(int fd) : fd(fd) {
+        setg(input, input, input);
+        setp(output, output + sizeof(output));
+    }
+    ~SocketStreamBuf() override { sync(); }
+
+protected:
+    int_type underflow() override {
+        ssize_t count;
+        do {
+            count = ::read(fd, input, sizeof(input));
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0) return traits_type::eof();
+        setg(input, input, input + count);
+        return traits_type::to_int_type(input[0]);
+    }
+
+    int_type overflow(int_type c) override {
+        if (sync() != 0) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        const char* data = pbase();
+        while (data < pptr()) {
+            ssize_t count = ::send(fd, data, pptr() - data, sendFlags);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return -1;
+            data += count;
+        }
+        setp(output, output + sizeof(output));
+        return 0;
+    }
+
+private:
+#ifdef MSG_NOSIGNAL
+    static constexpr int sendFlags = MSG_NOSIGNAL; // A client that hangs up must not kill the server
+#else
+    static constexpr int sendFlags = 0;
+#endif
+    int fd;
+    char input[1 << 16];
+    char output[1 << 12];
+};
+
+// Serves one connection at a time; each already uses every FFT thread.
+int serveUnixSocket(const std::string& socketPath, const ProcessOptions& options) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << socketPath << std::endl;
+        return -1;
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Failed to create socket: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    ::unlink(socketPath.c_str()); // A socket file left by an earlier run
+    if (::bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(server, 4) != 0) {
+        std::cerr << "Failed to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        ::close(server);
+        return -1;
+    }
+    std::cerr << "Listening on " << socketPath << std::endl;
+
+    for (;;) {
+        int client = ::accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Failed to accept connection: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        {
+            SocketStreamBuf buffer(client);
+            std::istream in(&buffer);
+            std::ostream out(&buffer);
+            serveRequests(in, out, options);
+        }
+        ::close(client);
+    }
+    ::close(server);
+    ::unlink(socketPath.c_str());
+    return -1;
+}
+#else
+int serveUnixSocket(const std::string& socketPath, const ProcessOptions& options) {
+    std::cerr << "Unix sockets are not available on this platform, use --serve with stdin instead." << std::endl;
+    return -1;
+}
+#endif
+
+// The files find_images in main.py picks up when it walks a directory
+bool hasImageExtension(const fs::path& path) {
+    const std::string extension = path.extension().string();
+    return extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+bool findImages(const std::string& target, vector<std::string>& paths, std::string& error) {
+    std::error_code status;
+    if (fs::is_directory(target, status)) {
+        fs::recursive_directory_iterator it(target, fs::directory_options::skip_permission_denied, status);
+        for (; !status && it != fs::recursive_directory_iterator(); it.increment(status)) {
+            if (it->is_regular_file(status) && hasImageExtension(it->path())) {
+                paths.push_back(it->path().string());
+            }
+        }
+        if (status) {
+            error = "cannot read " + target + ": " + status.message();
+            return false;
+        }
+    } else if (target.find_first_of("*?") != std::string::npos) {
+#ifdef FFT_GLOB
+        glob_t matches;
+        if (::glob(target.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) paths.push_back(matches.gl_pathv[i]);
+        }
+        ::globfree(&matches);
+#else
+        error = "glob patterns are not supported on this platform, pass a directory";
+        return false;
+#endif
+    } else if (fs::exists(target, status)) {
+        paths.push_back(target);
+    } else {
+        error = target + " is not a valid path or directory";
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+    return true;
+}
+
+// 64-bit FNV-1a, enough to tell whether a file's contents changed
+uint64_t contentHash(const vector<uchar>& bytes) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uchar byte : bytes) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Everything besides the file that decides the score; a cached result is only
+// reused when it was computed with the same settings
+std::string scanSettings(const ProcessOptions& options) {
+    return dispatchPrecision(options.precision, [&](auto tag) {
+        typedef typename decltype(tag)::type T;
+        char settings[128];
+        std::snprintf(settings, sizeof(settings), "%s e%d m%d cutoff %.17g reduce %d", precisionName(options.precision),
+                      ScalarTraits<T>::exponentBits, ScalarTraits<T>::significandBits, options.cutoff, options.reduce);
+        return std::string(settings);
+    });
+}
+
+// A scanned file's score, as kept in the cache
+struct ScanEntry {
+    std::string path;
+    uintmax_t size = 0;
+    long long modified = 0; // last_write_time ticks
+    uint64_t hash = 0;
+    std::string settings;
+    int rows = 0, cols = 0;
+    double blurriness = 0;
+};
+
+// Scores of files already scanned, kept as tab separated lines
+//   hash  size  modified  rows  cols  blurriness  settings  path
+// A file is skipped when its path, size and modification time match an
+// entry, or, once it has been read, when its size and hash do (a copied or
+// touched file). Entries are appended as files are scored, so an interrupted
+// scan keeps its progress; later lines override earlier ones, and save()
+// rewrites the file without the overridden lines and missing files.
+class ScanCache {
+public:
+    void load(const std::string& cachePath) {
+        std::ifstream file(cachePath);
+        std::string line;
+        while (std::getline(file, line)) {
+            ScanEntry entry;
+            if (parse(line, entry)) add(entry);
+        }
+    }
+
+    const ScanEntry* findPath(const std::string& path, const std::string& settings, uintmax_t size, long long modified) const {
+        auto it = byPath.find(path + '\t' + settings);
+        return it != byPath.end() && it->second.size == size && it->second.modified == modified ? &it->second : nullptr;
+    }
+
+    const ScanEntry* findContent(uint64_t hash, uintmax_t size, const std::string& settings) const {
+        auto it = byContent.find(contentKey(hash, size, settings));
+        if (it == byContent.end()) return nullptr;
+        const ScanEntry& entry = byPath.at(it->second);
+        return entry.hash == hash && entry.size == size ? &entry : nullptr;
+    }
+
+    void add(const ScanEntry& entry) {
+        const std::string key = entry.path + '\t' + entry.settings;
+        // A file that changed no longer has its old content
+        auto old = byPath.find(key);
+        if (old != byPath.end()) {
+            auto stale = byContent.find(contentKey(old->second.hash, old->second.size, old->second.settings));
+            if (stale != byContent.end() && stale->second == key) byContent.erase(stale);
+        }
+        byPath[key] = entry;
+        byContent[contentKey(entry.hash, entry.size, entry.settings)] = key;
+    }
+
+    static bool cacheable(const std::string& path) {
+        return path.find_first_of("\t\n\r") == std::string::npos;
+    }
+
+    static std::string line(const ScanEntry& entry) {
+        char numbers[160];
+        std::snprintf(numbers, sizeof(numbers), "%016llx\t%llu\t%lld\t%d\t%d\t%.17g\t", static_cast<unsigned long long>(entry.hash),
+                      static_cast<unsigned long long>(entry.size), entry.modified, entry.rows, entry.cols, entry.blurriness);
+        return numbers + entry.settings + '\t' + entry.path;
+    }
+
+    bool save(const std::string& cachePath) const {
+        const std::string temporary = cachePath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            file << header << "\n";
+            for (const auto& item : byPath) {
+                std::error_code status;
+                if (fs::exists(item.second.path, status)) file << line(item.second) << "\n";
+            }
+            if (!file) return false;
+        }
+        std::error_code status;
+        fs::rename(temporary, cachePath, status);
+        return !status;
+    }
+
+    static constexpr const char* header = "# NewFFT scan cache 1: hash size modified rows cols blurriness settings path";
+
+private:
+    static std::string contentKey(uint64_t hash, uintmax_t size, const std::string& settings) {
+        return std::to_string(hash) + ' ' + std::to_string(size) + '\t' + settings;
+    }
+
+    static bool parse(const std::string& line, ScanEntry& entry) {
+        if (line.empty() || line[0] == '#') return false;
+        vector<std::string> fields;
+        size_t start = 0;
+        for (int i = 0; i < 7; ++i) {
+            const size_t end = line.find('\t', start);
+            if (end == std::string::npos) return false;
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+        entry.hash = std::strtoull(fields[0].c_str(), nullptr, 16);
+        entry.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+        entry.modified = std::strtoll(fields[2].c_str(), nullptr, 10);
+        entry.rows = std::atoi(fields[3].c_str());
+        entry.cols = std::atoi(fields[4].c_str());
+        entry.blurriness = std::strtod(fields[5].c_str(), nullptr);
+        entry.settings = fields[6];
+        entry.path = line.substr(start);
+        return !entry.path.empty();
+    }
+
+    std::unordered_map<std::string, ScanEntry> byPath;      // path and settings -> entry
+    std::unordered_map<std::string, std::string> byContent; // hash, size and settings -> byPath key
+};
+
+// A decoded image on its way from an I/O thread to an FFT worker
+struct ScanItem {
+    ScanEntry entry;
+    Mat image;
+    double decodeMs = 0;
+};
+
+// One JSON line per file, in the order the files finish
+std::string scanRecordJson(const ScanEntry& entry, const ImageReport& report, bool cached) {
+    std::ostringstream json;
+    json << "{\"path\": \"" << jsonEscape(entry.path) << "\", \"ok\": " << (report.ok ? "true" : "false");
+    if (!report.ok) {
+        json << ", \"error\": \"" << jsonEscape(report.error) << "\"";
+    }
+    json << ", \"cached\": " << (cached ? "true" : "false") << ", \"size\": " << entry.size;
+    if (report.ok) {
+        json.precision(9);
+        json << ", \"rows\": " << report.rows << ", \"cols\": " << report.cols << ", \"blurriness\": ";
+        if (std::isfinite(report.blurriness)) json << report.blurriness;
+        else json << "null";
+    }
+    json.precision(4);
+    json << std::fixed << ", \"decode_ms\": " << report.decodeMs << ", \"fft_ms\": " << report.fftMs << "}";
+    return json.str();
+}
+
+// I/O threads claim paths from a shared index. For each file they check the
+// cache, read the bytes, hash them, check the cache again by content and
+// decode what is left into a BoundedQueue. FFT workers pop the decoded images
+// and score them. Each worker transforms whole images on its own thread with
+// the thread-local buffers of analyzeImage, so the FFT thread pool is cut to
+// one thread for the scan when there is more than one worker. Results and cache lines are
+// written under one mutex as files finish.
+int scanImages(const std::string& target, const ProcessOptions& options, const ScanOptions& scan) {
+    vector<std::string> paths;
+    std::string error;
+    if (!findImages(target, paths, error)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+
+    ScanCache cache;
+    std::ofstream cacheLog;
+    if (!scan.cachePath.empty()) {
+        cache.load(scan.cachePath);
+        const bool fresh = !fs::exists(scan.cachePath);
+        cacheLog.open(scan.cachePath, std::ios::app);
+        if (!cacheLog.is_open()) {
+            std::cerr << "Failed to open cache file: " << scan.cachePath << std::endl;
+            return -1;
+        }
+        if (fresh) cacheLog << ScanCache::header << "\n";
+    }
+    std::ofstream outputFile;
+    if (!scan.outputPath.empty()) {
+        outputFile.open(scan.outputPath, std::ios::trunc);
+        if (!outputFile.is_open()) {
+            std::cerr << "Failed to open output file: " << scan.outputPath << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& out = scan.outputPath.empty() ? std::cout : outputFile;
+
+    // Only the score is wanted, nothing is written next to the images
+    ProcessOptions analysis = options;
+    analysis.headless = true;
+    analysis.saveSpectrum = false;
+    const std::string settings = scanSettings(options);
+    const int workers = scan.fftWorkers > 0 ? scan.fftWorkers : max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int readers = max(1, scan.ioThreads);
+    ScopedFFTThreadCount threadCount(workers > 1 ? 1 : fftThreadCount);
+    getFFTThreadPool(); // Built here, before the workers share it
+
+    std::mutex outputMutex;
+    int analyzed = 0, cached = 0, failed = 0;
+    vector<ScanEntry> newEntries;
+    // newEntry is false for a file found in the cache under its own path, which needs no new cache line
+    auto finish = [&](const ScanEntry& entry, const ImageReport& report, bool fromCache, bool newEntry) {
+        const std::string record = scanRecordJson(entry, report, fromCache);
+        std::lock_guard<std::mutex> lock(outputMutex);
+        out << record << "\n";
+        if (!report.ok) {
+            ++failed;
+        } else {
+            fromCache ? ++cached : ++analyzed;
+            if (newEntry && cacheLog.is_open() && ScanCache::cacheable(entry.path)) {
+                ScanEntry scored = entry;
+                scored.rows = report.rows;
+                scored.cols = report.cols;
+                scored.blurriness = report.blurriness;
+                cacheLog << ScanCache::line(scored) << "\n";
+                newEntries.push_back(scored);
+            }
+        }
+    };
+    auto fromCacheEntry = [](const ScanEntry& hit) {
+        ImageReport report;
+        report.ok = true;
+        report.rows = hit.rows;
+        report.cols = hit.cols;
+        report.blurriness = hit.blurriness;
+        return report;
+    };
+
+    BoundedQueue<ScanItem> queue(scan.queueCapacity > 0 ? scan.queueCapacity : 2 * workers);
+    std::atomic<size_t> nextPath{0};
+    std::atomic<int> readersLeft{readers};
+    auto start = std::chrono::steady_clock::now();
+
+    auto readFiles = [&] {
+        vector<uchar> bytes;
+        for (size_t i; (i = nextPath.fetch_add(1)) < paths.size();) {
+            ScanItem item;
+            ScanEntry& entry = item.entry;
+            entry.path = paths[i];
+            entry.settings = settings;
+            ImageReport report;
+            std::error_code status;
+            entry.size = fs::file_size(entry.path, status);
+            if (!status) entry.modified = static_cast<long long>(fs::last_write_time(entry.path, status).time_since_epoch().count());
+            if (status) {
+                report.error = "cannot read file: " + status.message();
+                finish(entry, report, false, false);
+                continue;
+            }
+            if (const ScanEntry* hit = cache.findPath(entry.path, settings, entry.size, entry.modified)) {
+                finish(entry, fromCacheEntry(*hit), true, false);
+                continue;
+            }
+
+            const ScanEntry* hit = nullptr;
+            {
+                auto decodeStart = std::chrono::steady_clock::now();
+                ScopedTimer timer("decode", entry.path);
+                std::ifstream file(entry.path, std::ios::binary);
+                bytes.resize(entry.size);
+                if (file.read(reinterpret_cast<char*>(bytes.data()), std::streamsize(bytes.size()))) {
+                    entry.hash = contentHash(bytes);
+                    hit = cache.findContent(entry.hash, entry.size, settings);
+                    if (!hit) item.image = imdecode(bytes, grayscaleReadFlag(options.reduce));
+                } else {
+                    report.error = "cannot read file";
+                }
+                item.decodeMs = millisecondsSince(decodeStart);
+            }
+            if (hit) {
+                finish(entry, fromCacheEntry(*hit), true, true); // Same contents under a new name or time
+                continue;
+            }
+            if (item.image.empty()) {
+                if (report.error.empty()) report.error = "could not load image";
+                report.decodeMs = item.decodeMs;
+                finish(entry, report, false, false);
+                continue;
+            }
+            queue.push(item);
+        }
+        // The last reader to leave tells the workers that nothing more is coming
+        if (readersLeft.fetch_sub(1) == 1) queue.close();
+    };
+
+    auto analyzeImages = [&] {
+        ScanItem item;
+        while (queue.pop(item)) {
+            ImageReport report = analyzeImage(item.image, "", analysis);
+            report.decodeMs = item.decodeMs;
+            item.image = Mat();
+            finish(item.entry, report, false, true);
+        }
+    };
+
+    vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i) threads.emplace_back(readFiles);
+    for (int i = 0; i < workers; ++i) threads.emplace_back(analyzeImages);
+    for (auto& thread : threads) thread.join();
+    out.flush();
+
+    if (cacheLog.is_open()) {
+        cacheLog.close();
+        for (const ScanEntry& entry : newEntries) cache.add(entry);
+        if (!cache.save(scan.cachePath)) {
+            std::cerr << "Failed to rewrite cache file: " << scan.cachePath << std::endl;
+        }
+    }
+    std::cerr << "Scanned " << paths.size() << " files in " << millisecondsSince(start) / 1000.0 << " s: " << analyzed
+              << " analyzed, " << cached << " from the cache, " << failed << " failed" << std::endl;
+    return 0;
+}
+
+// A frame on its way through analyzeVideo's pipeline. The slots are allocated
+// once and handed from stage to stage by pointer, so after the first frames
+// no buffer is allocated again.
+struct FrameSlot {
+    int index = 0;    // Frame number in the source
+    int sequence = 0; // Position among the frames that are scored
+    Mat color, gray, reduced;
+};
+
+// Per-frame results leave the pipeline out of order; they are written back in
+// frame order, and the sharpest frames are kept on a min-heap of size top
+class FrameTimeline {
+public:
+    FrameTimeline(std::ostream& out, double fps, int top) : out(out), fps(fps), top(top) {}
+
+    void add(int sequence, int index, const ImageReport& report) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[sequence] = std::make_pair(index, report);
+        for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it), ++next) {
+            write(it->second.first, it->second.second);
+        }
+    }
+
+    int scored() const { return next; }
+
+    // Indices of the sharpest frames, sharpest first
+    vector<int> sharpest() const {
+        vector<std::pair<double, int>> frames = heap;
+        std::sort(frames.begin(), frames.end(), [](const std::pair<double, int>& a, const std::pair<double, int>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+        vector<int> indices;
+        for (const auto& frame : frames) indices.push_back(frame.second);
+        return indices;
+    }
+
+private:
+    void write(int index, const ImageReport& report) {
+        std::ostringstream json;
+        json << "{\"frame\": " << index << ", \"time_s\": ";
+        if (fps > 0) json << index / fps;
+        else json << "null";
+        json << ", \"ok\": " << (report.ok ? "true" : "false");
+        if (!report.ok) json << ", \"error\": \"" << jsonEscape(report.error) << "\"";
+        json.precision(9);
+        json << ", \"blurriness\": ";
+        if (report.ok && std::isfinite(report.blurriness)) json << report.blurriness;
+        else json << "null";
+        json.precision(4);
+        json << std::fixed << ", \"fft_ms\": " << report.fftMs << "}";
+        out << json.str() << "\n";
+
+        // A blank frame has no score and cannot be the sharpest
+        if (top <= 0 || !report.ok || !std::isfinite(report.blurriness)) return;
+        auto sharper = [](const std::pair<double, int>& a, const std::pair<double, int>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        };
+        heap.emplace_back(report.blurriness, index);
+        std::push_heap(heap.begin(), heap.end(), sharper);
+        if (static_cast<int>(heap.size()) > top) {
+            std::pop_heap(heap.begin(), heap.end(), sharper);
+            heap.pop_back();
+        }
+    }
+
+    std::ostream& out;
+    double fps;
+    int top;
+    std::mutex mutex;
+    int next = 0;
+    std::map<int, std::pair<int, ImageReport>> pending;
+    vector<std::pair<double, int>> heap; // Least sharp of the kept frames on top
+};
+
+// Decoding, grayscale conversion and scoring run as overlapping stages: one
+// thread reads frames from the VideoCapture (which is not thread-safe), one
+// converts them to grayscale (and reduces them with --reduce), and the FFT
+// workers score them, each frame on a single thread like scanImages. Frames
+// move between stages through BoundedQueues of pointers to a fixed ring of
+// FrameSlots, so a slow stage holds the others back instead of piling up
+// frames. Frames that are not scored (before skip, or between strides) are
+// only grabbed, never decoded. A source that is just a number opens that camera.
+int analyzeVideo(const std::string& source, const ProcessOptions& options, const VideoOptions& video) {
+    VideoCapture capture;
+    const bool camera = !source.empty() && source.size() <= 3 && std::all_of(source.begin(), source.end(), ::isdigit);
+    if (camera) capture.open(std::stoi(source));
+    else capture.open(source);
+    if (!capture.isOpened()) {
+        std::cerr << "Failed to open video or frame sequence: " << source << std::endl;
+        return -1;
+    }
+    std::ofstream outputFile;
+    if (!video.outputPath.empty()) {
+        outputFile.open(video.outputPath, std::ios::trunc);
+        if (!outputFile.is_open()) {
+            std::cerr << "Failed to open output file: " << video.outputPath << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& out = video.outputPath.empty() ? std::cout : outputFile;
+
+    ProcessOptions analysis = options;
+    analysis.headless = true;
+    analysis.saveSpectrum = false;
+    const int workers = video.workers > 0 ? video.workers : max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int stride = max(1, video.stride);
+    ScopedFFTThreadCount threadCount(workers > 1 ? 1 : fftThreadCount);
+    getFFTThreadPool(); // Built here, before the workers share it
+
+    vector<FrameSlot> slots(2 * workers + 4);
+    BoundedQueue<FrameSlot*> freeSlots(slots.size()), decoded(slots.size()), converted(slots.size());
+    for (FrameSlot& slot : slots) {
+        FrameSlot* pointer = &slot;
+        freeSlots.tryPush(pointer);
+    }
+    FrameTimeline timeline(out, capture.get(CAP_PROP_FPS), video.topFrames);
+    int framesRead = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread decoder([&] {
+        int index = 0, sequence = 0;
+        for (; index < video.skip && capture.grab(); ++index) {}
+        for (; video.maxFrames <= 0 || sequence < video.maxFrames; ++index) {
+            if ((index - video.skip) % stride != 0) {
+                if (!capture.grab()) break;
+                continue;
+            }
+            FrameSlot* slot;
+            freeSlots.pop(slot);
+            bool read;
+            {
+                ScopedTimer timer("decode");
+                read = capture.read(slot->color) && !slot->color.empty();
+            }
+            if (!read) {
+                freeSlots.push(slot);
+                break;
+            }
+            slot->index = index;
+            slot->sequence = sequence++;
+            decoded.push(slot);
+        }
+        framesRead = index;
+        decoded.close();
+    });
+
+    std::thread converter([&] {
+        FrameSlot* slot;
+        while (decoded.pop(slot)) {
+            {
+                ScopedTimer timer("grayscale");
+                if (slot->color.channels() == 1) {
+                    slot->gray = slot->color;
+                } else {
+                    cvtColor(slot->color, slot->gray, COLOR_BGR2GRAY);
+                }
+                if (options.reduce > 1) {
+                    resize(slot->gray, slot->reduced, Size(), 1.0 / options.reduce, 1.0 / options.reduce, INTER_AREA);
+                }
+            }
+            converted.push(slot);
+        }
+        converted.close();
+    });
+
+    vector<std::thread> scorers;
+    for (int i = 0; i < workers; ++i) {
+        scorers.emplace_back([&] {
+            FrameSlot* slot;
+            while (converted.pop(slot)) {
+                const ImageReport report = analyzeImage(options.reduce > 1 ? slot->reduced : slot->gray, "", analysis);
+                const int index = slot->index, sequence = slot->sequence;
+                freeSlots.push(slot);
+                timeline.add(sequence, index, report);
+            }
+        });
+    }
+
+    decoder.join();
+    converter.join();
+    for (auto& scorer : scorers) scorer.join();
+    const double seconds = millisecondsSince(start) / 1000.0;
+
+    const vector<int> sharpest = timeline.sharpest();
+    std::ostringstream summary;
+    summary << "{\"frames_read\": " << framesRead << ", \"frames_scored\": " << timeline.scored() << ", \"seconds\": " << seconds
+            << ", \"frames_per_second\": " << (seconds > 0 ? timeline.scored() / seconds : 0.0) << ", \"sharpest_frames\": [";
+    for (size_t i = 0; i < sharpest.size(); ++i) summary << (i ? ", " : "") << sharpest[i];
+    summary << "]}";
+    out << summary.str() << std::endl;
+    std::cerr << "Scored " << timeline.scored() << " of " << framesRead << " frames in " << seconds << " s ("
+              << (seconds > 0 ? timeline.scored() / seconds : 0.0) << " frames/s)" << std::endl;
+    return 0;
+}
+
+#ifndef TESTING
+int main(int argc, char** argv) {
+    std::vector<std::string> imagePaths;
+    ProcessOptions options;
+    bool serve = false;
+    bool saveServedSpectra = false;
+    bool printStageMetrics = false;
+    std::string socketPath;
+    std::string tracePath;
+    std::string scanTarget;
+    std::string videoSource;
+    ScanOptions scan;
+    VideoOptions video;
+    bool useCache = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            setFFTThreadCount(std::atoi(argv[++i]));
+        } else if (arg == "--csv") {
+            options.writeCsv = true;
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            serve = true;
+            socketPath = argv[++i];
+        } else if (arg == "--save-spectrum") {
+            saveServedSpectra = true;
+        } else if (arg == "--blur-map" && i + 1 < argc) {
+            options.blurMapTile = std::atoi(argv[++i]);
+            if (options.blurMapTile < 2) {
+                std::cerr << "--blur-map needs a tile size of at least 2" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--score-only") {
+            options.scoreOnly = true;
+        } else if (arg == "--reduce" && i + 1 < argc) {
+            options.reduce = std::atoi(argv[++i]);
+            if (options.reduce != 1 && options.reduce != 2 && options.reduce != 4 && options.reduce != 8) {
+                std::cerr << "--reduce must be 1, 2, 4 or 8" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--precision" && i + 1 < argc) {
+            if (!parsePrecision(argv[++i], options.precision)) {
+                std::cerr << "--precision must be fp16, bf16, floatx, fp32 or fp64" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--memory-budget" && i + 1 < argc) {
+            const long long megabytes = std::atoll(argv[++i]);
+            if (megabytes <= 0) {
+                std::cerr << "--memory-budget needs a size in megabytes" << std::endl;
+                return -1;
+            }
+            options.memoryBudget = size_t(megabytes) << 20;
+        } else if (arg == "--scratch-dir" && i + 1 < argc) {
+            options.scratchDirectory = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--metrics") {
+            printStageMetrics = true;
+        } else if (arg == "--scan" && i + 1 < argc) {
+            scanTarget = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            scan.fftWorkers = std::atoi(argv[++i]);
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            scan.ioThreads = std::atoi(argv[++i]);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            scan.cachePath = argv[++i];
+        } else if (arg == "--no-cache") {
+            useCache = false;
+        } else if (arg == "--out" && i + 1 < argc) {
+            scan.outputPath = argv[++i];
+        } else if (arg == "--video" && i + 1 < argc) {
+            videoSource = argv[++i];
+        } else if (arg == "--stride" && i + 1 < argc) {
+            video.stride = std::atoi(argv[++i]);
+            if (video.stride < 1) {
+                std::cerr << "--stride must be at least 1" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--skip" && i + 1 < argc) {
+            video.skip = max(0, std::atoi(argv[++i]));
+        } else if (arg == "--max-frames" && i + 1 < argc) {
+            video.maxFrames = max(0, std::atoi(argv[++i]));
+        } else if (arg == "--top" && i + 1 < argc) {
+            video.topFrames = max(0, std::atoi(argv[++i]));
+        } else if (arg == "--cutoff" && i + 1 < argc) {
+            options.cutoff = std::atof(argv[++i]);
+            if (!(options.cutoff >= 0.0 && options.cutoff < 0.5)) {
+                std::cerr << "--cutoff must be in [0, 0.5)" << std::endl;
+                return -1;
+            }
+        } else {
+            imagePaths.push_back(arg);
+        }
+    }
+
+    if (options.writeCsv && options.memoryBudget > 0) {
+        std::cerr << "--csv needs the whole spectrum in memory and cannot be combined with --memory-budget" << std::endl;
+        return -1;
+    }
+
+    if (!serve && scanTarget.empty() && videoSource.empty() && imagePaths.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--csv] [--headless] [--score-only] [--blur-map TileSize] [--reduce 2|4|8] [--cutoff C] [--precision fp16|bf16|floatx|fp32|fp64] [--memory-budget MB] [--scratch-dir Dir] [--trace File] [--metrics] <ImagePath1> <ImagePath2> ..." << std::endl;
+        std::cerr << "       " << argv[0] << " [--threads N] [--csv] [--save-spectrum] [--reduce 2|4|8] [--cutoff C] [--precision P] [--memory-budget MB] [--trace File] [--metrics] --serve | --socket <Path>" << std::endl;
+        std::cerr << "       " << argv[0] << " [--workers N] [--io-threads N] [--cache File | --no-cache] [--out File] [--reduce 2|4|8] [--cutoff C] [--precision P] [--memory-budget MB] [--trace File] [--metrics] --scan <DirectoryOrGlob>" << std::endl;
+        std::cerr << "       " << argv[0] << " [--workers N] [--stride N] [--skip N] [--max-frames N] [--top K] [--out File] [--reduce 2|4|8] [--cutoff C] [--precision P] [--trace File] [--metrics] --video <VideoOrFramePattern>" << std::endl;
+        return -1;
+    }
+
+    // Timers stay idle unless something will read them
+    if (!tracePath.empty() || printStageMetrics) {
+        fftTracer.start();
+    }
+
+    int status = 0;
+    if (!videoSource.empty()) {
+        video.workers = scan.fftWorkers;
+        video.outputPath = scan.outputPath;
+        status = analyzeVideo(videoSource, options, video);
+    } else if (!scanTarget.empty()) {
+        // The cache lives in the scanned directory unless told otherwise
+        if (!useCache) {
+            scan.cachePath.clear();
+        } else if (scan.cachePath.empty()) {
+            scan.cachePath = ((fs::is_directory(scanTarget) ? fs::path(scanTarget) : fs::path(".")) / ".newfft_scan_cache").string();
+        }
+        status = scanImages(scanTarget, options, scan);
+    } else if (serve) {
+        // stdout carries the JSON replies, so nothing else may be printed there.
+        // Spectra are only written when asked for with --save-spectrum.
+        options.headless = true;
+        options.saveSpectrum = saveServedSpectra;
+        std::ios::sync_with_stdio(false);
+        status = socketPath.empty() ? serveRequests(std::cin, std::cout, options) : serveUnixSocket(socketPath, options);
+    } else {
+        for (const auto& path : imagePaths) {
+            std::cout << "Processing: " << path << std::endl;
+            processSingleImage(path, options);
+        }
+    }
+
+    fftTracer.stop();
+    if (printStageMetrics) {
+        printMetrics(std::cerr);
+    }
+    if (!tracePath.empty() && !writeTrace(tracePath)) {
+        status = -1;
+    }
+    return status;
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,445 @@
+// Python extension module around the FFT and blurriness code in NewFFT.cpp.
+// Build it with: python3 setup.py build_ext --inplace
+//
+//   import newfft
+//   spectrum = newfft.rfft2(image)      # half spectrum, rows x (cols / 2 + 1), complex128
+//   spectrum = newfft.fft2(image)       # full spectrum, rows x cols, complex128
+//   score = newfft.blurriness(image, cutoff=0.2)   # never stores the spectrum
+//   score, spectrum = newfft.analyze(image, cutoff=0.2)
+//   grid = newfft.blur_map(image, tile=64, cutoff=0.2)  # blurriness per tile
+//
+// Every function takes precision="fp16", "bf16", "floatx" (the default),
+// "fp32" or "fp64". fp32 spectra are complex64, the others complex128.
+//
+// Images are any 2D buffer of uint8 or float32 (a NumPy array, memoryview, ...)
+// and are read in place. Spectra are NumPy arrays viewing the C++ matrix that
+// produced them, which stays alive as long as any view of it does; fp16 spectra
+// are the exception, they are computed scaled down (see inputScale) and
+// returned rescaled in a new array. The GIL is released while transforming.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define TESTING
+#include "NewFFT.cpp"
+
+namespace {
+
+// Buffer format of a spectrum in the scalar type T. FloatX formats are handed
+// to NumPy as complex128, which only works because FloatX keeps its value in a
+// plain double.
+template <typename T> struct SpectrumFormat {
+    static_assert(sizeof(MyComplex<T>) == 2 * sizeof(double), "MyComplex must be laid out as two doubles");
+    static constexpr const char* code = "Zd";
+};
+template <> struct SpectrumFormat<float> {
+    static constexpr const char* code = "Zf";
+};
+
+// fft2D and rfft2D share one thread pool, which runs one job at a time
+std::mutex engineMutex;
+
+// Owns a ComplexMatrix<T> of any scalar type and describes its memory
+struct SpectrumObject {
+    PyObject_HEAD
+    void* matrix;
+    void (*destroy)(void* matrix);
+    void* data;
+    int rows, cols, stride;
+    Py_ssize_t itemsize;
+    const char* format;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    Py_ssize_t byteShape[2];   // The same memory as rows of bytes, for consumers that do not ask for the format
+    Py_ssize_t byteStrides[2];
+};
+
+void spectrumDealloc(PyObject* self) {
+    SpectrumObject* spectrum = reinterpret_cast<SpectrumObject*>(self);
+    PyTypeObject* type = Py_TYPE(self);
+    spectrum->destroy(spectrum->matrix);
+    type->tp_free(self);
+    Py_DECREF(type); // Instances of a heap type own a reference to it
+}
+
+int spectrumGetBuffer(PyObject* self, Py_buffer* view, int flags) {
+    SpectrumObject* spectrum = reinterpret_cast<SpectrumObject*>(self);
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && spectrum->stride != spectrum->cols) {
+        PyErr_SetString(PyExc_BufferError, "spectrum rows are padded, a strided buffer is required");
+        return -1;
+    }
+    // Without PyBUF_FORMAT the format must be left null, which means unsigned
+    // bytes, so the items are described as bytes too
+    const bool typed = (flags & PyBUF_FORMAT) == PyBUF_FORMAT;
+
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = spectrum->data;
+    view->len = static_cast<Py_ssize_t>(spectrum->rows) * spectrum->cols * spectrum->itemsize;
+    view->readonly = 0;
+    view->itemsize = typed ? spectrum->itemsize : 1;
+    view->format = typed ? const_cast<char*>(spectrum->format) : nullptr;
+    if ((flags & PyBUF_ND) == PyBUF_ND) {
+        view->ndim = 2;
+        view->shape = typed ? spectrum->shape : spectrum->byteShape;
+    } else {
+        view->ndim = 1;
+        view->shape = nullptr;
+    }
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? (typed ? spectrum->strides : spectrum->byteStrides) : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+PyType_Slot spectrumSlots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void*>(spectrumDealloc)},
+    {Py_tp_doc, const_cast<char*>("C++ spectrum matrix, exported through the buffer protocol")},
+    {Py_bf_getbuffer, reinterpret_cast<void*>(spectrumGetBuffer)},
+    {0, nullptr}
+};
+
+PyType_Spec spectrumSpec = {"newfft.Spectrum", sizeof(SpectrumObject), 0, Py_TPFLAGS_DEFAULT, spectrumSlots};
+
+// Created from spectrumSpec when the module is imported
+PyTypeObject* SpectrumType = nullptr;
+
+// Wraps matrix in a Spectrum and returns numpy.asarray of it, a view without a copy
+template <typename T>
+PyObject* spectrumArray(ComplexMatrix<T>* matrix) {
+    SpectrumObject* spectrum = PyObject_New(SpectrumObject, SpectrumType);
+    if (!spectrum) {
+        delete matrix;
+        return nullptr;
+    }
+    spectrum->matrix = matrix;
+    spectrum->destroy = [](void* owned) { delete static_cast<ComplexMatrix<T>*>(owned); };
+    spectrum->data = matrix->data.data();
+    spectrum->rows = matrix->rows;
+    spectrum->cols = matrix->cols;
+    spectrum->stride = matrix->stride;
+    spectrum->itemsize = sizeof(MyComplex<T>);
+    spectrum->format = SpectrumFormat<T>::code;
+    spectrum->shape[0] = spectrum->byteShape[0] = matrix->rows;
+    spectrum->shape[1] = matrix->cols;
+    spectrum->byteShape[1] = static_cast<Py_ssize_t>(matrix->cols * spectrum->itemsize);
+    spectrum->strides[0] = spectrum->byteStrides[0] = static_cast<Py_ssize_t>(matrix->stride * spectrum->itemsize);
+    spectrum->strides[1] = spectrum->itemsize;
+    spectrum->byteStrides[1] = 1;
+    const double scale = matrix->scale;
+
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (!numpy) {
+        Py_DECREF(spectrum);
+        return nullptr;
+    }
+    PyObject* array = PyObject_CallMethod(numpy, "asarray", "O", reinterpret_cast<PyObject*>(spectrum));
+    Py_DECREF(numpy);
+    Py_DECREF(spectrum);
+    if (!array || scale == 1.0) return array;
+    PyObject* divisor = PyFloat_FromDouble(scale);
+    PyObject* rescaled = divisor ? PyNumber_TrueDivide(array, divisor) : nullptr;
+    Py_XDECREF(divisor);
+    Py_DECREF(array);
+    return rescaled;
+}
+
+// A 2D uint8 or float32 image borrowed from a Python buffer. Rows may be
+// strided; pixels within a row must be contiguous, otherwise they are copied.
+struct ImageBuffer {
+    Py_buffer view{};
+    bool held = false;
+    bool isFloat = false;
+    int rows = 0, cols = 0;
+    const void* pixels = nullptr;
+    size_t step = 0; // Elements from one row to the next
+    vector<unsigned char> copy;
+
+    ~ImageBuffer() {
+        if (held) PyBuffer_Release(&view);
+    }
+
+    bool acquire(PyObject* object) {
+        if (PyObject_GetBuffer(object, &view, PyBUF_STRIDED_RO | PyBUF_FORMAT) != 0) return false;
+        held = true;
+
+        std::string format = view.format ? view.format : "B";
+        if (!format.empty() && std::strchr("@=<", format[0])) format.erase(0, 1);
+        if (format == "B" && view.itemsize == 1) {
+            isFloat = false;
+        } else if (format == "f" && view.itemsize == 4) {
+            isFloat = true;
+        } else {
+            PyErr_Format(PyExc_TypeError, "image must be uint8 or float32, not format '%s'", view.format ? view.format : "?");
+            return false;
+        }
+        if (view.ndim != 2 || view.shape[0] <= 0 || view.shape[1] <= 0 || view.shape[0] > INT_MAX || view.shape[1] > INT_MAX) {
+            PyErr_SetString(PyExc_ValueError, "image must be a non-empty 2D array");
+            return false;
+        }
+        rows = static_cast<int>(view.shape[0]);
+        cols = static_cast<int>(view.shape[1]);
+
+        const Py_ssize_t rowStride = view.strides[0];
+        const Py_ssize_t colStride = view.strides[1];
+        if (colStride == view.itemsize && rowStride >= 0 && rowStride % view.itemsize == 0) {
+            pixels = view.buf;
+            step = rowStride / view.itemsize;
+            return true;
+        }
+
+        // Transposed, reversed or otherwise scattered pixels: gather into a dense copy
+        copy.resize(size_t(rows) * cols * view.itemsize);
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < cols; ++x) {
+                const char* source = static_cast<const char*>(view.buf) + y * rowStride + x * colStride;
+                std::memcpy(copy.data() + (size_t(y) * cols + x) * view.itemsize, source, view.itemsize);
+            }
+        }
+        pixels = copy.data();
+        step = cols;
+        return true;
+    }
+
+    template <typename T>
+    void rfft(ComplexMatrix<T>& spectrum) const {
+        if (isFloat) rfft2D(static_cast<const float*>(pixels), step, rows, cols, spectrum);
+        else rfft2D(static_cast<const unsigned char*>(pixels), step, rows, cols, spectrum);
+    }
+
+    template <typename T>
+    void blurMap(int tileSize, double cutoff, BlurMap& map) const {
+        if (isFloat) computeBlurMap<T>(static_cast<const float*>(pixels), step, rows, cols, tileSize, cutoff, map);
+        else computeBlurMap<T>(static_cast<const unsigned char*>(pixels), step, rows, cols, tileSize, cutoff, map);
+    }
+
+    template <typename T>
+    double score(double cutoff) const {
+        if (isFloat) return blurScore<T>(static_cast<const float*>(pixels), step, rows, cols, cutoff);
+        return blurScore<T>(static_cast<const unsigned char*>(pixels), step, rows, cols, cutoff);
+    }
+
+    template <typename T>
+    void fft(ComplexMatrix<T>& spectrum) const {
+        spectrum.resize(rows, cols);
+        spectrum.scale = isFloat ? inputScale<T>(static_cast<const float*>(pixels), step, rows, cols, rows, cols)
+                                 : inputScale<T>(static_cast<const unsigned char*>(pixels), step, rows, cols, rows, cols);
+        for (int y = 0; y < rows; ++y) {
+            MyComplex<T>* out = spectrum.row(y);
+            for (int x = 0; x < cols; ++x) {
+                double value = isFloat ? static_cast<const float*>(pixels)[y * step + x]
+                                       : static_cast<const unsigned char*>(pixels)[y * step + x];
+                out[x] = MyComplex<T>(T(spectrum.scale * value), T(0.0));
+            }
+        }
+        fft2D(spectrum, false);
+    }
+};
+
+// Reads the precision= argument, a name accepted by parsePrecision
+bool parsePrecisionArg(const char* name, Precision& precision) {
+    precision = Precision::FloatX;
+    if (name && !parsePrecision(name, precision)) {
+        PyErr_Format(PyExc_ValueError, "precision must be fp16, bf16, floatx, fp32 or fp64, not '%s'", name);
+        return false;
+    }
+    return true;
+}
+
+// rfft2() and fft2(): the spectrum of image in the requested precision
+PyObject* transform(PyObject* args, PyObject* kwargs, bool half) {
+    static const char* keywords[] = {"image", "precision", nullptr};
+    PyObject* object;
+    const char* name = nullptr;
+    Precision precision;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|s", const_cast<char**>(keywords), &object, &name)) return nullptr;
+    if (!parsePrecisionArg(name, precision)) return nullptr;
+    ImageBuffer image;
+    if (!image.acquire(object)) return nullptr;
+    return dispatchPrecision(precision, [&](auto tag) {
+        typedef typename decltype(tag)::type T;
+        ComplexMatrix<T>* spectrum = new ComplexMatrix<T>();
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::lock_guard<std::mutex> lock(engineMutex);
+            if (half) image.rfft(*spectrum);
+            else image.fft(*spectrum);
+        }
+        Py_END_ALLOW_THREADS
+        return spectrumArray(spectrum);
+    });
+}
+
+PyObject* pyRfft2(PyObject*, PyObject* args, PyObject* kwargs) {
+    return transform(args, kwargs, true);
+}
+
+PyObject* pyFft2(PyObject*, PyObject* args, PyObject* kwargs) {
+    return transform(args, kwargs, false);
+}
+
+// image, an optional cutoff and precision, as passed to blurriness() and analyze()
+bool parseImageArgs(PyObject* args, PyObject* kwargs, PyObject*& object, double& cutoff, Precision& precision) {
+    static const char* keywords[] = {"image", "cutoff", "precision", nullptr};
+    const char* name = nullptr;
+    cutoff = defaultBlurCutoff;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ds", const_cast<char**>(keywords), &object, &cutoff, &name)) return false;
+    if (!(cutoff >= 0.0 && cutoff < 0.5)) {
+        PyErr_SetString(PyExc_ValueError, "cutoff must be in [0, 0.5)");
+        return false;
+    }
+    return parsePrecisionArg(name, precision);
+}
+
+PyObject* pyBlurriness(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* object;
+    double cutoff;
+    Precision precision;
+    if (!parseImageArgs(args, kwargs, object, cutoff, precision)) return nullptr;
+    ImageBuffer image;
+    if (!image.acquire(object)) return nullptr;
+    double blurriness;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        blurriness = dispatchPrecision(precision, [&](auto tag) {
+            return image.score<typename decltype(tag)::type>(cutoff);
+        });
+    }
+    Py_END_ALLOW_THREADS
+    return PyFloat_FromDouble(blurriness);
+}
+
+PyObject* pyAnalyze(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* object;
+    double cutoff;
+    Precision precision;
+    if (!parseImageArgs(args, kwargs, object, cutoff, precision)) return nullptr;
+    ImageBuffer image;
+    if (!image.acquire(object)) return nullptr;
+    return dispatchPrecision(precision, [&](auto tag) -> PyObject* {
+        typedef typename decltype(tag)::type T;
+        ComplexMatrix<T>* spectrum = new ComplexMatrix<T>();
+        double blurriness;
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::lock_guard<std::mutex> lock(engineMutex);
+            image.rfft(*spectrum);
+            blurriness = calculateBlurriness(*spectrum, cutoff);
+        }
+        Py_END_ALLOW_THREADS
+        PyObject* array = spectrumArray(spectrum);
+        if (!array) return nullptr;
+        return Py_BuildValue("(dN)", blurriness, array);
+    });
+}
+
+PyObject* pyBlurMap(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"image", "tile", "cutoff", "precision", nullptr};
+    PyObject* object;
+    int tileSize = 64;
+    double cutoff = defaultBlurCutoff;
+    const char* name = nullptr;
+    Precision precision;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ids", const_cast<char**>(keywords), &object, &tileSize, &cutoff, &name)) return nullptr;
+    if (tileSize < 2 || !(cutoff >= 0.0 && cutoff < 0.5)) {
+        PyErr_SetString(PyExc_ValueError, "tile must be at least 2 and cutoff in [0, 0.5)");
+        return nullptr;
+    }
+    if (!parsePrecisionArg(name, precision)) return nullptr;
+    ImageBuffer image;
+    if (!image.acquire(object)) return nullptr;
+    BlurMap map;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        dispatchPrecision(precision, [&](auto tag) {
+            image.blurMap<typename decltype(tag)::type>(tileSize, cutoff, map);
+        });
+    }
+    Py_END_ALLOW_THREADS
+
+    // The grid is small, so it is copied into a bytearray that the array then owns
+    PyObject* bytes = PyByteArray_FromStringAndSize(reinterpret_cast<const char*>(map.scores.data()),
+                                                    static_cast<Py_ssize_t>(map.scores.size() * sizeof(double)));
+    if (!bytes) return nullptr;
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (!numpy) {
+        Py_DECREF(bytes);
+        return nullptr;
+    }
+    PyObject* flat = PyObject_CallMethod(numpy, "frombuffer", "Os", bytes, "float64");
+    Py_DECREF(numpy);
+    Py_DECREF(bytes);
+    if (!flat) return nullptr;
+    PyObject* grid = PyObject_CallMethod(flat, "reshape", "ii", map.gridRows, map.gridCols);
+    Py_DECREF(flat);
+    return grid;
+}
+
+PyObject* pySetThreads(PyObject*, PyObject* args) {
+    int threads;
+    if (!PyArg_ParseTuple(args, "i", &threads)) return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        setFFTThreadCount(threads);
+    }
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+PyObject* pyPrecision(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"name", nullptr};
+    const char* name = nullptr;
+    Precision precision;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", const_cast<char**>(keywords), &name)) return nullptr;
+    if (!parsePrecisionArg(name, precision)) return nullptr;
+    return dispatchPrecision(precision, [](auto tag) {
+        typedef typename decltype(tag)::type T;
+        return Py_BuildValue("(ii)", ScalarTraits<T>::exponentBits, ScalarTraits<T>::significandBits);
+    });
+}
+
+PyMethodDef moduleMethods[] = {
+    {"rfft2", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyRfft2)), METH_VARARGS | METH_KEYWORDS,
+     "rfft2(image, precision='floatx') -> half spectrum of a real 2D image, rows x (cols // 2 + 1)"},
+    {"fft2", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyFft2)), METH_VARARGS | METH_KEYWORDS,
+     "fft2(image, precision='floatx') -> full spectrum of a real 2D image, rows x cols"},
+    {"blurriness", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyBlurriness)), METH_VARARGS | METH_KEYWORDS,
+     "blurriness(image, cutoff=0.2, precision='floatx') -> share of magnitude above normalized frequency cutoff, lower is blurrier"},
+    {"analyze", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyAnalyze)), METH_VARARGS | METH_KEYWORDS,
+     "analyze(image, cutoff=0.2, precision='floatx') -> (blurriness, half spectrum)"},
+    {"blur_map", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyBlurMap)), METH_VARARGS | METH_KEYWORDS,
+     "blur_map(image, tile=64, cutoff=0.2, precision='floatx') -> blurriness of Hann windowed tiles overlapping by half, one per grid cell"},
+    {"set_threads", pySetThreads, METH_VARARGS, "set_threads(n) -> use n FFT threads, 0 for one per hardware thread"},
+    {"precision", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(pyPrecision)), METH_VARARGS | METH_KEYWORDS,
+     "precision(name='floatx') -> (exponent bits, significand bits) of fp16, bf16, floatx, fp32 or fp64"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+PyModuleDef moduleDef = {PyModuleDef_HEAD_INIT, "newfft", "FloatX FFT and blurriness measure from NewFFT.cpp", -1, moduleMethods,
+                         nullptr, nullptr, nullptr, nullptr};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_newfft() {
+    SpectrumType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&spectrumSpec));
+    if (!SpectrumType) return nullptr;
+
+    PyObject* module = PyModule_Create(&moduleDef);
+    if (!module) return nullptr;
+    Py_INCREF(SpectrumType);
+    if (PyModule_AddObject(module, "Spectrum", reinterpret_cast<PyObject*>(SpectrumType)) < 0) {
+        Py_DECREF(SpectrumType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    PyObject* precisions = Py_BuildValue("(sssss)", precisionName(Precision::Half), precisionName(Precision::BFloat16),
+                                         precisionName(Precision::FloatX), precisionName(Precision::Single), precisionName(Precision::Double));
+    if (!precisions || PyModule_AddObject(module, "precisions", precisions) < 0) {
+        Py_XDECREF(precisions);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
@@ -0,0 +1,378 @@
+#define TESTING
+#include "/home/thatchaoskid/Documents/final_qub_project/NewFFT.cpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+// Speed and accuracy of the FFT engine against cv::dft, across sizes, number
+// formats and thread counts. Every case is timed after one warm-up run (which
+// builds the plans and the per-thread buffers), and its output is compared with
+// cv::dft of the same input in double precision. Results are written as JSON,
+// one case per line, so a file from an earlier version can be passed back with
+// --baseline to flag cases that got slower.
+// NewFFT's forward transform uses the e^(+i) convention, so it is compared
+// with cv::dft(DFT_INVERSE) without scaling, and its inverse with the forward
+// cv::dft divided by the number of points.
+//
+// Kinds:
+//   fft1d   every row as its own 1D transform, the rows spread over the thread pool
+//   fft2d   complex 2D transform (fft2D)
+//   ifft2d  inverse complex 2D transform
+//   rfft2d  the real-input half spectrum the image pipeline computes (rfft2D)
+
+struct BenchResult {
+    double seconds = 0.0;     // Median time of one run
+    double bestSeconds = 0.0;
+    double gflops = 0.0;
+    double mpixelsPerSecond = 0.0;
+    double allocations = 0.0; // AlignedAllocator allocations per run
+    double maxError = 0.0;    // Largest error relative to the largest reference magnitude
+    double rmsError = 0.0;    // RMS error relative to the RMS reference magnitude
+    int threads = 0;
+};
+
+// Deterministic 8-bit noise: pixels as CV_8UC1, and a CV_64FC2 copy whose
+// imaginary part holds a second, independent image
+void syntheticInput(int rows, int cols, Mat& pixels, Mat& complexInput) {
+    pixels.create(rows, cols, CV_8UC1);
+    complexInput.create(rows, cols, CV_64FC2);
+    uint32_t state = 12345u + rows * 7919u + cols;
+    auto next = [&] {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<uchar>(state >> 24);
+    };
+    for (int y = 0; y < rows; ++y) {
+        double* out = complexInput.ptr<double>(y);
+        for (int x = 0; x < cols; ++x) {
+            pixels.at<uchar>(y, x) = next();
+            out[2 * x] = pixels.at<uchar>(y, x);
+            out[2 * x + 1] = next();
+        }
+    }
+}
+
+void realToComplex(const Mat& pixels, Mat& complexInput) {
+    complexInput.create(pixels.rows, pixels.cols, CV_64FC2);
+    for (int y = 0; y < pixels.rows; ++y) {
+        double* out = complexInput.ptr<double>(y);
+        for (int x = 0; x < pixels.cols; ++x) {
+            out[2 * x] = pixels.at<uchar>(y, x);
+            out[2 * x + 1] = 0.0;
+        }
+    }
+}
+
+Mat referenceTransform(const std::string& kind, const Mat& complexInput) {
+    int flags = DFT_COMPLEX_OUTPUT;
+    if (kind == "fft1d") flags |= DFT_ROWS;
+    if (kind != "ifft2d") flags |= DFT_INVERSE;
+    Mat reference;
+    dft(complexInput, reference, flags);
+    if (kind == "ifft2d") {
+        const double points = double(reference.rows) * reference.cols;
+        for (int y = 0; y < reference.rows; ++y) {
+            double* row = reference.ptr<double>(y);
+            for (int x = 0; x < 2 * reference.cols; ++x) row[x] /= points;
+        }
+    }
+    return reference;
+}
+
+// Nominal operation count of an n point complex FFT, 5 n log2(n), as
+// benchFFT counts it whatever algorithm actually runs
+double fftFlops(double n) {
+    return n > 1 ? 5.0 * n * std::log2(n) : 0.0;
+}
+
+template <typename T>
+void compareToReference(const ComplexMatrix<T>& result, const Mat& reference, BenchResult& bench) {
+    double largestError = 0.0, errorSquares = 0.0, largestValue = 0.0, valueSquares = 0.0;
+    for (int y = 0; y < result.rows; ++y) {
+        const double* expected = reference.ptr<double>(y);
+        for (int x = 0; x < result.cols; ++x) {
+            const double re = static_cast<double>(result(y, x).real) / result.scale;
+            const double im = static_cast<double>(result(y, x).imag) / result.scale;
+            const double error = std::hypot(re - expected[2 * x], im - expected[2 * x + 1]);
+            const double value = std::hypot(expected[2 * x], expected[2 * x + 1]);
+            largestError = std::isnan(error) ? error : max(largestError, error);
+            errorSquares += error * error;
+            largestValue = max(largestValue, value);
+            valueSquares += value * value;
+        }
+    }
+    bench.maxError = largestValue > 0 ? largestError / largestValue : largestError;
+    bench.rmsError = valueSquares > 0 ? std::sqrt(errorSquares / valueSquares) : std::sqrt(errorSquares);
+}
+
+template <typename T>
+BenchResult runCase(const std::string& kind, const Mat& pixels, const Mat& complexInput, const Mat& reference, int repeat) {
+    const int rows = pixels.rows, cols = pixels.cols;
+    ThreadPool& pool = getFFTThreadPool();
+    ComplexMatrix<T> data;
+
+    std::function<void()> load, run;
+    if (kind == "rfft2d") {
+        load = [] {};
+        run = [&] { rfft2D(pixels, data); };
+    } else {
+        // Complex input is scaled like the image pipeline's, so fp16 stays in range
+        const double scale = inputScale<T>(complexInput.ptr<double>(0), complexInput.step / sizeof(double), rows, 2 * cols,
+                                           kind == "fft1d" ? 1 : rows, cols);
+        load = [&, scale] {
+            data.resize(rows, cols);
+            data.scale = scale;
+            for (int y = 0; y < rows; ++y) {
+                const double* in = complexInput.ptr<double>(y);
+                for (int x = 0; x < cols; ++x) {
+                    data(y, x) = MyComplex<T>(T(scale * in[2 * x]), T(scale * in[2 * x + 1]));
+                }
+            }
+        };
+        if (kind == "fft1d") {
+            run = [&] {
+                const FFTPlan<T>& plan = getFFTPlan<T>(cols);
+                pool.parallelFor(0, rows, max(1, rows / (pool.size() * 8)), [&](int begin, int end) {
+                    for (int y = begin; y < end; ++y) fft(data.row(y), plan, false);
+                });
+            };
+        } else {
+            const bool invert = kind == "ifft2d";
+            run = [&, invert] { fft2D(data, invert); };
+        }
+    }
+
+    load();
+    run();
+    vector<double> times;
+    const long long allocations = fftCounters.allocations;
+    for (int r = 0; r < repeat; ++r) {
+        load();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    BenchResult bench;
+    bench.threads = pool.size();
+    bench.allocations = double(fftCounters.allocations - allocations) / repeat;
+    std::sort(times.begin(), times.end());
+    bench.bestSeconds = times.front();
+    bench.seconds = times[times.size() / 2];
+    const double points = double(rows) * cols;
+    const double flops = kind == "fft1d" ? rows * fftFlops(cols) : kind == "rfft2d" ? fftFlops(points) / 2 : fftFlops(points);
+    bench.gflops = flops / bench.seconds / 1e9;
+    bench.mpixelsPerSecond = points / bench.seconds / 1e6;
+    compareToReference(data, reference, bench);
+    return bench;
+}
+
+// JSON has no NaN or infinity, so a transform that overflowed reports null
+std::string jsonNumber(double value, const char* format) {
+    if (!std::isfinite(value)) return "null";
+    char text[32];
+    std::snprintf(text, sizeof(text), format, value);
+    return text;
+}
+
+// "1024" for 1024 x 1024, or "1080x1920" for 1080 rows of 1920 columns
+bool parseSize(const std::string& text, int& rows, int& cols) {
+    size_t at = text.find('x');
+    rows = std::atoi(text.substr(0, at).c_str());
+    cols = at == std::string::npos ? rows : std::atoi(text.substr(at + 1).c_str());
+    return rows > 0 && cols > 0;
+}
+
+vector<std::string> splitList(const std::string& text) {
+    vector<std::string> items;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// Median seconds per case name from an earlier run's output
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> seconds;
+    std::ifstream file(path);
+    std::string line;
+    const std::string nameKey = "{\"name\": \"", secondsKey = "\"seconds\": ";
+    while (std::getline(file, line)) {
+        size_t name = line.find(nameKey);
+        size_t value = line.find(secondsKey);
+        if (name == std::string::npos || value == std::string::npos) continue;
+        name += nameKey.size();
+        seconds[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + value + secondsKey.size());
+    }
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    std::string sizesArg = "256,1024,2048,480x640,1080x1920,3000x4000";
+    std::string kindsArg = "fft1d,fft2d,ifft2d,rfft2d";
+    std::string precisionsArg = "floatx,fp32";
+    std::string threadsArg = "1,0";
+    std::string imageDirectory = "../ImagesToTest";
+    std::string outPath, baselinePath;
+    int repeat = 3;
+    double tolerance = 0.1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return -1;
+        }
+        if (arg == "--sizes") sizesArg = argv[++i];
+        else if (arg == "--kinds") kindsArg = argv[++i];
+        else if (arg == "--precisions") precisionsArg = argv[++i];
+        else if (arg == "--threads") threadsArg = argv[++i];
+        else if (arg == "--images") imageDirectory = argv[++i];
+        else if (arg == "--repeat") repeat = max(1, std::atoi(argv[++i]));
+        else if (arg == "--out") outPath = argv[++i];
+        else if (arg == "--baseline") baselinePath = argv[++i];
+        else if (arg == "--tolerance") tolerance = std::atof(argv[++i]);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--sizes 1024,1080x1920] [--kinds fft1d,fft2d,ifft2d,rfft2d] [--precisions floatx,fp32]"
+                      << " [--threads 1,0] [--images Dir|none] [--repeat N] [--out File] [--baseline File] [--tolerance 0.1]" << std::endl;
+            return -1;
+        }
+    }
+
+    vector<Precision> precisions;
+    for (const std::string& name : splitList(precisionsArg)) {
+        Precision precision;
+        if (!parsePrecision(name, precision)) {
+            std::cerr << "Unknown precision: " << name << std::endl;
+            return -1;
+        }
+        precisions.push_back(precision);
+    }
+    vector<int> threadCounts;
+    for (const std::string& count : splitList(threadsArg)) threadCounts.push_back(std::atoi(count.c_str()));
+    const vector<std::string> kinds = splitList(kindsArg);
+    for (const std::string& kind : kinds) {
+        if (kind != "fft1d" && kind != "fft2d" && kind != "ifft2d" && kind != "rfft2d") {
+            std::cerr << "Unknown kind: " << kind << std::endl;
+            return -1;
+        }
+    }
+
+    // Synthetic inputs of every size, then every image of the test set (real input only)
+    struct Input {
+        std::string label;
+        Mat pixels, complexInput;
+        bool realOnly;
+    };
+    vector<Input> inputs;
+    for (const std::string& size : splitList(sizesArg)) {
+        int rows, cols;
+        if (!parseSize(size, rows, cols)) {
+            std::cerr << "Bad size: " << size << std::endl;
+            return -1;
+        }
+        Input input{std::to_string(rows) + "x" + std::to_string(cols), Mat(), Mat(), false};
+        syntheticInput(rows, cols, input.pixels, input.complexInput);
+        inputs.push_back(input);
+    }
+    if (imageDirectory != "none" && fs::is_directory(imageDirectory)) {
+        vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(imageDirectory)) {
+            const std::string extension = entry.path().extension().string();
+            if (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".pgm") files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (const fs::path& file : files) {
+            Input input{file.filename().string(), imread(file.string(), IMREAD_GRAYSCALE), Mat(), true};
+            if (input.pixels.empty()) {
+                std::cerr << "Skipping " << file.string() << ": could not decode it" << std::endl;
+                continue;
+            }
+            input.label += " " + std::to_string(input.pixels.rows) + "x" + std::to_string(input.pixels.cols);
+            realToComplex(input.pixels, input.complexInput);
+            inputs.push_back(input);
+        }
+    }
+
+    std::ofstream outFile;
+    if (!outPath.empty()) {
+        outFile.open(outPath);
+        if (!outFile.is_open()) {
+            std::cerr << "Failed to open " << outPath << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : outFile;
+    const std::map<std::string, double> baseline = baselinePath.empty() ? std::map<std::string, double>() : readBaseline(baselinePath);
+    if (!baselinePath.empty() && baseline.empty()) {
+        std::cerr << "No cases found in baseline " << baselinePath << std::endl;
+        return -1;
+    }
+
+    out << "{\"benchmark\": \"NewFFT\", \"floatx_exponent_bits\": " << f << ", \"floatx_significand_bits\": " << l
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"repeat\": " << repeat << ", \"cases\": [";
+    bool first = true;
+    int regressions = 0;
+    for (const Input& input : inputs) {
+        for (const std::string& kind : kinds) {
+            if (input.realOnly && kind != "rfft2d") continue;
+            // One reference per input and kind, shared by every format and thread count
+            Mat reference;
+            if (kind == "rfft2d") {
+                Mat realInput;
+                realToComplex(input.pixels, realInput);
+                reference = referenceTransform("fft2d", realInput);
+            } else {
+                reference = referenceTransform(kind, input.complexInput);
+            }
+            for (Precision precision : precisions) {
+                vector<int> poolSizes; // 0 and the hardware thread count are the same pool
+                for (int threads : threadCounts) {
+                    setFFTThreadCount(threads);
+                    if (std::find(poolSizes.begin(), poolSizes.end(), getFFTThreadPool().size()) != poolSizes.end()) continue;
+                    poolSizes.push_back(getFFTThreadPool().size());
+                    const BenchResult bench = dispatchPrecision(precision, [&](auto tag) {
+                        return runCase<typename decltype(tag)::type>(kind, input.pixels, input.complexInput, reference, repeat);
+                    });
+                    const std::string name = kind + " " + input.label + " " + precisionName(precision) + " t" + std::to_string(bench.threads);
+
+                    char numbers[512];
+                    std::snprintf(numbers, sizeof(numbers),
+                                  "\"seconds\": %.6g, \"best_seconds\": %.6g, \"gflops\": %.4g, \"mpixels_per_second\": %.4g, "
+                                  "\"allocations\": %g",
+                                  bench.seconds, bench.bestSeconds, bench.gflops, bench.mpixelsPerSecond, bench.allocations);
+                    out << (first ? "\n" : ",\n") << "{\"name\": \"" << jsonEscape(name) << "\", \"kind\": \"" << kind
+                        << "\", \"rows\": " << input.pixels.rows << ", \"cols\": " << input.pixels.cols << ", \"precision\": \""
+                        << precisionName(precision) << "\", \"threads\": " << bench.threads << ", " << numbers
+                        << ", \"max_error\": " << jsonNumber(bench.maxError, "%.3g") << ", \"rms_error\": " << jsonNumber(bench.rmsError, "%.3g") << "}";
+                    first = false;
+
+                    std::snprintf(numbers, sizeof(numbers), "%10.3f ms %8.3f GFLOP/s %9.2f MPixel/s  max error %.2e",
+                                  bench.seconds * 1e3, bench.gflops, bench.mpixelsPerSecond, bench.maxError);
+                    std::cerr << name << ": " << numbers;
+                    auto before = baseline.find(name);
+                    if (before != baseline.end()) {
+                        const double change = bench.seconds / before->second - 1.0;
+                        std::snprintf(numbers, sizeof(numbers), "  %+.1f%% vs baseline", change * 100.0);
+                        std::cerr << numbers;
+                        if (change > tolerance) {
+                            std::cerr << "  SLOWER";
+                            ++regressions;
+                        }
+                    }
+                    std::cerr << std::endl;
+                }
+            }
+        }
+    }
+    out << "\n]}\n";
+    setFFTThreadCount(0);
+
+    if (regressions > 0) {
+        std::cerr << regressions << " case(s) more than " << tolerance * 100.0 << "% slower than the baseline" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -34,8 +34,8 @@ void testNextPowerOfTwo() {
 
 void testMyComplexOperations() {
     // Test addition
-    MyComplex a(1.0, 2.0), b(3.0, 4.0);
-    MyComplex result = a + b;
+    MyComplex<> a(1.0, 2.0), b(3.0, 4.0);
+    MyComplex<> result = a + b;
     assert(nearlyEqual(result.real, 4.0) && nearlyEqual(result.imag, 6.0) && "MyComplex addition failed");
 
     // Test subtraction
@@ -46,31 +46,755 @@ void testMyComplexOperations() {
     result = a * b;
     assert(nearlyEqual(result.real, -5.0) && nearlyEqual(result.imag, 10.0) && "MyComplex multiplication failed");
 
-    // Test abs (magnitude)
-    double magnitude = result.abs();
-    assert(nearlyEqual(magnitude, std::sqrt(125.0)) && "MyComplex abs (magnitude) failed");
+    // Test abs (magnitude), to within a few ulps of the 12 bit significand
+    assert(nearlyEqual(result.abs(), std::sqrt(125.0), 1e-3 * std::sqrt(125.0)) && "MyComplex abs (magnitude) failed");
 
     std::cout << "MyComplex operation tests passed." << std::endl;
 }
 
-// Example test for FFT functionality
+// FFT of a known signal. The transform uses e^{+2*pi*i*jk/n} in the forward direction.
 void testFFT() {
-    std::vector<MyComplex> data = {{0, 0}, {1, 0}, {0, 0}, {1, 0}};
+    std::vector<MyComplex<>> data = {{0, 0}, {1, 0}, {0, 0}, {1, 0}};
     fft(data, false);  // Perform FFT
-    for (const auto& val : data) {
-        std::cout << "FFT result: (" << val.real << ", " << val.imag << ")\n";
-    }
-    // Here you would assert on expected values. This is an illustrative example;
-    // exact assertions would depend on the expected outcome of your FFT operation.
+    assert(nearlyEqual(data[0].real, 2.0) && nearlyEqual(data[0].imag, 0.0) && "FFT failed at bin 0");
+    assert(nearlyEqual(data[1].real, 0.0) && nearlyEqual(data[1].imag, 0.0) && "FFT failed at bin 1");
+    assert(nearlyEqual(data[2].real, -2.0) && nearlyEqual(data[2].imag, 0.0) && "FFT failed at bin 2");
+    assert(nearlyEqual(data[3].real, 0.0) && nearlyEqual(data[3].imag, 0.0) && "FFT failed at bin 3");
+
+    // Other lengths are transformed at their own size, without zero padding
+    std::vector<MyComplex<>> odd = {{1, 0}, {1, 0}, {1, 0}};
+    fft(odd, false);
+    assert(odd.size() == 3 && "FFT changed the input length");
+    assert(nearlyEqual(odd[0].real, 3.0) && nearlyEqual(odd[1].real, 0.0, 1e-3) && nearlyEqual(odd[2].imag, 0.0, 1e-3) && "FFT of length 3 failed");
     std::cout << "FFT tests passed." << std::endl;
 }
 
+// Compares the planned FFT against a direct DFT and checks that the inverse restores the input
+void testFFTMatchesDFT() {
+    const int n = 64;
+    std::vector<MyComplex<>> data(n);
+    for (int i = 0; i < n; ++i) {
+        data[i] = MyComplex<>(std::sin(0.3 * i) + (i % 7), std::cos(0.11 * i));
+    }
+    std::vector<MyComplex<>> original = data;
+
+    fft(data, false);
+    for (int k = 0; k < n; ++k) {
+        double re = 0.0, im = 0.0;
+        for (int j = 0; j < n; ++j) {
+            double angle = 2 * PI * j * k / n;
+            double xr = original[j].real, xi = original[j].imag;
+            re += xr * std::cos(angle) - xi * std::sin(angle);
+            im += xr * std::sin(angle) + xi * std::cos(angle);
+        }
+        // Tolerance covers the reduced FloatX significand
+        assert(nearlyEqual(data[k].real, re, 0.5) && nearlyEqual(data[k].imag, im, 0.5) && "FFT does not match DFT");
+    }
+
+    fft(data, true);
+    for (int i = 0; i < n; ++i) {
+        assert(nearlyEqual(data[i].real, original[i].real, 0.05) && nearlyEqual(data[i].imag, original[i].imag, 0.05) && "Inverse FFT failed");
+    }
+
+    // Plans are cached per length
+    assert(&getFFTPlan(n) == &getFFTPlan(n) && "FFT plan was not reused");
+    std::cout << "FFT vs DFT tests passed." << std::endl;
+}
+
+// Mixed-radix (2, 3, 4, 5, 7) and Bluestein lengths against a direct DFT, relative to the peak bin
+void testArbitraryLengthFFT() {
+    const int lengths[] = {6, 12, 15, 35, 49, 60, 120, 1080, 13, 22, 683};
+    for (int n : lengths) {
+        std::vector<MyComplex<>> data(n);
+        for (int i = 0; i < n; ++i) {
+            data[i] = MyComplex<>(std::sin(0.37 * i) * 100 + (i % 5), std::cos(0.21 * i) * 50);
+        }
+        std::vector<MyComplex<>> original = data;
+        fft(data, false);
+
+        double peak = 0.0, worst = 0.0;
+        for (int k = 0; k < n; ++k) {
+            double re = 0.0, im = 0.0;
+            for (int j = 0; j < n; ++j) {
+                double angle = 2 * PI * double((long long)j * k % n) / n;
+                re += original[j].real * std::cos(angle) - original[j].imag * std::sin(angle);
+                im += original[j].real * std::sin(angle) + original[j].imag * std::cos(angle);
+            }
+            peak = std::max(peak, std::hypot(re, im));
+            worst = std::max(worst, std::hypot(data[k].real - re, data[k].imag - im));
+        }
+        assert(worst < 2e-3 * peak && "Mixed-radix or Bluestein FFT does not match DFT");
+
+        fft(data, true);
+        for (int i = 0; i < n; ++i) {
+            assert(nearlyEqual(data[i].real, original[i].real, 1.0) && nearlyEqual(data[i].imag, original[i].imag, 1.0) && "Inverse FFT failed");
+        }
+    }
+    std::cout << "Arbitrary length FFT tests passed." << std::endl;
+}
+
+// 2D FFT on the contiguous matrix against a direct 2D DFT, then back again
+void testFFT2D() {
+    const int rows = 8, cols = 16;
+    ComplexMatrix<> data(rows, cols);
+    assert(data.stride >= cols && reinterpret_cast<uintptr_t>(data.row(1)) % 64 == 0 && "ComplexMatrix rows are not aligned");
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            data(y, x) = MyComplex<>((x * 3 + y * 5) % 11, 0);
+        }
+    }
+    ComplexMatrix<> original = data;
+
+    fft2D(data, false);
+    for (int v = 0; v < rows; ++v) {
+        for (int u = 0; u < cols; ++u) {
+            double re = 0.0, im = 0.0;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < cols; ++x) {
+                    double angle = 2 * PI * (double(u * x) / cols + double(v * y) / rows);
+                    re += original(y, x).real * std::cos(angle);
+                    im += original(y, x).real * std::sin(angle);
+                }
+            }
+            assert(nearlyEqual(data(v, u).real, re, 1.0) && nearlyEqual(data(v, u).imag, im, 1.0) && "fft2D does not match 2D DFT");
+        }
+    }
+
+    fft2D(data, true);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            assert(nearlyEqual(data(y, x).real, original(y, x).real, 0.05) && "Inverse fft2D failed");
+        }
+    }
+    std::cout << "fft2D tests passed." << std::endl;
+}
+
+// The threaded passes must give exactly the same bits as a single thread
+void testFFT2DThreads() {
+    const int rows = 64, cols = 128;
+    ComplexMatrix<> serial(rows, cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            serial(y, x) = MyComplex<>((x * x + 3 * y) % 251, 0);
+        }
+    }
+    ComplexMatrix<> threaded = serial;
+
+    setFFTThreadCount(1);
+    fft2D(serial, false);
+    setFFTThreadCount(4);
+    const long long transforms = fftCounters.transforms;
+    fft2D(threaded, false);
+    setFFTThreadCount(0);
+
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            assert(static_cast<double>(serial(y, x).real) == static_cast<double>(threaded(y, x).real) &&
+                   static_cast<double>(serial(y, x).imag) == static_cast<double>(threaded(y, x).imag) &&
+                   "Threaded fft2D differs from serial");
+        }
+    }
+    assert(fftCounters.transforms - transforms == rows + cols && "fft2D transform counter is wrong");
+    std::cout << "Threaded fft2D tests passed." << std::endl;
+}
+
+// The vectorized butterflies must round exactly like the scalar floatx code
+void testSimdMatchesScalar() {
+    const int rows = 60, cols = 256; // Radix 4, 3 and 5 columns, radix 4 rows
+    ComplexMatrix<> scalar(rows, cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            scalar(y, x) = MyComplex<>(std::sin(0.7 * x * y) * 255.0, std::cos(0.05 * x) * 1e-3);
+        }
+    }
+    ComplexMatrix<> vectorized = scalar;
+
+    setSimdKernelsEnabled(false);
+    fft2D(scalar, false);
+    setSimdKernelsEnabled(true);
+    fft2D(vectorized, false);
+
+    assert(std::memcmp(scalar.data.data(), vectorized.data.data(), scalar.data.size() * sizeof(MyComplex<>)) == 0 &&
+           "SIMD fft2D differs from scalar floatx fft2D");
+    std::cout << "SIMD kernel tests passed (" << (getFFTKernels<>().butterfly ? "vectorized" : "scalar only") << ")." << std::endl;
+}
+
+// The real-input transform keeps only cols / 2 + 1 columns but must agree with the full transform
+void testRealFFT2D() {
+    const int rows = 13, cols = 20; // Odd row count, a Bluestein column length and a mixed-radix row length
+    std::vector<unsigned char> pixels(rows * cols);
+    ComplexMatrix<> full(rows, cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            pixels[y * cols + x] = static_cast<unsigned char>((x * 37 + y * y * 11) % 256);
+            full(y, x) = MyComplex<>(pixels[y * cols + x], 0);
+        }
+    }
+
+    fft2D(full, false);
+    ComplexMatrix<> half;
+    rfft2D(pixels.data(), cols, rows, cols, half);
+
+    assert(half.rows == rows && half.fullCols == cols && half.cols == cols / 2 + 1 && "rfft2D has the wrong shape");
+    for (int y = 0; y < full.rows; ++y) {
+        for (int x = 0; x < full.cols; ++x) {
+            MyComplex<> value = half.at(y, x);
+            assert(nearlyEqual(value.real, full(y, x).real, 8.0) && nearlyEqual(value.imag, full(y, x).imag, 8.0) && "rfft2D does not match fft2D");
+        }
+    }
+    assert(nearlyEqual(calculateBlurriness(half), calculateBlurriness(full), 0.01) && "Blurriness differs between half and full spectrum");
+    std::cout << "Real-input fft2D tests passed." << std::endl;
+}
+
+// Test the .npy writer: header, 64 byte aligned data and values read back
+void testSaveFFTResultsNpy() {
+    ComplexMatrix<> data(3, 5);
+    for (int y = 0; y < data.rows; ++y) {
+        for (int x = 0; x < data.cols; ++x) {
+            data(y, x) = MyComplex<>(y * 10 + x, -x);
+        }
+    }
+    std::string path = (fs::temp_directory_path() / "newfft_test_results.npy").string();
+    assert(saveFFTResultsNpy(data, path) && "saveFFTResultsNpy failed");
+
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    assert(bytes.compare(0, 6, "\x93NUMPY") == 0 && "Missing .npy magic");
+    size_t dataOffset = 10 + static_cast<unsigned char>(bytes[8]) + (static_cast<unsigned char>(bytes[9]) << 8);
+    assert(dataOffset % 64 == 0 && "Data is not 64 byte aligned");
+    std::string header = bytes.substr(10, dataOffset - 10);
+    assert(header.find("'descr': '<c8'") != std::string::npos && header.find("'shape': (3, 5)") != std::string::npos && "Wrong .npy header");
+    assert(bytes.size() == dataOffset + 3 * 5 * 2 * sizeof(float) && "Wrong .npy size");
+
+    const float* values = reinterpret_cast<const float*>(bytes.data() + dataOffset);
+    assert(values[2 * (2 * 5 + 3)] == 23.0f && values[2 * (2 * 5 + 3) + 1] == -3.0f && "Wrong .npy data");
+
+    fs::remove(path);
+    fs::remove(fs::path(path).replace_extension(".json"));
+    std::cout << ".npy output tests passed." << std::endl;
+}
+
+// Test the headless request loop on raw frames and a bad request
+void testServeRequests() {
+    const int rows = 12, cols = 10;
+    std::string frame(rows * cols, '\0');
+    for (int i = 0; i < rows * cols; ++i) {
+        frame[i] = static_cast<char>((i * 29) % 256);
+    }
+    ComplexMatrix<> expected;
+    rfft2D(reinterpret_cast<const unsigned char*>(frame.data()), cols, rows, cols, expected);
+
+    std::istringstream in("frame 12 10\n" + frame + "frame x\nframe 01.png\nframe 0 4\n\nquit\nframe 1 1\n");
+    std::ostringstream out;
+    ProcessOptions options;
+    options.headless = true;
+    options.saveSpectrum = false;
+    serveRequests(in, out, options);
+
+    std::istringstream replies(out.str());
+    std::string first, second, path, empty, extra;
+    assert(std::getline(replies, first) && std::getline(replies, second) && std::getline(replies, path) && std::getline(replies, empty) && !std::getline(replies, extra) && "Expected one reply per request up to quit");
+    assert(first.find("\"id\": \"frame 0\", \"ok\": true") != std::string::npos && first.find("\"rows\": 12, \"cols\": 10") != std::string::npos && "Frame request failed");
+    size_t at = first.find("\"blurriness\": ");
+    assert(at != std::string::npos && "Missing blurriness");
+    double blurriness = std::stod(first.substr(at + 14));
+    assert(std::fabs(blurriness - calculateBlurriness(expected)) < 1e-6 && "Served blurriness differs from calculateBlurriness");
+    assert(second.find("\"ok\": false") != std::string::npos && second.find("\"error\"") != std::string::npos && "Bad request was not reported");
+    // A path that starts with the word frame is still a path
+    assert(path.find("\"id\": \"frame 01.png\"") != std::string::npos && path.find("could not load image") != std::string::npos && "Path starting with frame was read as a frame");
+    assert(empty.find("\"id\": \"frame 1\", \"ok\": false") != std::string::npos && "Empty frame was not reported");
+    std::cout << "Server mode tests passed." << std::endl;
+}
+
+// Test the blurriness metric against its definition, and the fused path against the stored spectrum
+void testBlurScore() {
+    const int rows = 30, cols = 44;
+    std::vector<unsigned char> pixels(rows * cols);
+    ComplexMatrix<> full(rows, cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            pixels[y * cols + x] = static_cast<unsigned char>((x * x * 7 + y * 13 + x * y) % 256);
+            full(y, x) = MyComplex<>(pixels[y * cols + x], 0);
+        }
+    }
+    fft2D(full, false);
+
+    for (double cutoff : {0.0, 0.1, defaultBlurCutoff, 0.4}) {
+        // Straight from the definition: max(|fy|, |fx|) > cutoff over the full spectrum
+        double total = 0.0, high = 0.0;
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < cols; ++x) {
+                double fy = std::fabs(y <= rows / 2 ? y : y - rows) / double(rows);
+                double fx = std::fabs(x <= cols / 2 ? x : x - cols) / double(cols);
+                double magnitude = std::hypot(double(full(y, x).real), double(full(y, x).imag));
+                total += magnitude;
+                if (std::max(fy, fx) > cutoff) high += magnitude;
+            }
+        }
+        double expected = high / total;
+
+        ComplexMatrix<> half;
+        rfft2D(pixels.data(), cols, rows, cols, half);
+        assert(nearlyEqual(calculateBlurriness(full, cutoff), expected, 1e-9) && "calculateBlurriness does not match its definition");
+        assert(nearlyEqual(calculateBlurriness(half, cutoff), expected, 1e-3) && "Half spectrum blurriness differs");
+        assert(nearlyEqual(blurScore(pixels.data(), cols, rows, cols, cutoff), calculateBlurriness(half, cutoff), 1e-12) && "Fused blurScore differs from calculateBlurriness");
+    }
+
+    setFFTThreadCount(1);
+    double serial = blurScore(pixels.data(), cols, rows, cols);
+    setFFTThreadCount(4); // More than one thread even on a single core machine
+    assert(serial == blurScore(pixels.data(), cols, rows, cols) && "blurScore depends on the thread count");
+    setFFTThreadCount(0);
+    std::cout << "Blur score tests passed." << std::endl;
+}
+
+// Test the blur map: tile layout, paired tiles against a direct windowed FFT, and sharp vs smooth regions
+void testBlurMap() {
+    const int rows = 40, cols = 70, tile = 16;
+    std::vector<unsigned char> pixels(rows * cols);
+    unsigned int seed = 12345;
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            seed = seed * 1103515245u + 12345u;
+            // Noise on the left, a slow ramp on the right
+            pixels[y * cols + x] = x < cols / 2 ? static_cast<unsigned char>(seed >> 24) : static_cast<unsigned char>(100 + x + y);
+        }
+    }
+
+    BlurMap map;
+    computeBlurMap(pixels.data(), cols, rows, cols, tile, defaultBlurCutoff, map);
+    assert(map.tileSize == tile && map.stride == tile / 2 && "Wrong tile layout");
+    assert(map.gridRows == 4 && map.gridCols == 8 && map.scores.size() == 32 && "Wrong blur map grid");
+    assert(map.tileTop(map.gridRows - 1) == rows - tile && map.tileLeft(map.gridCols - 1) == cols - tile && "Last tiles must end at the border");
+
+    for (int t : {0, 1, 2, 31}) {
+        const int gy = t / map.gridCols, gx = t % map.gridCols;
+        ComplexMatrix<> windowed(tile, tile);
+        for (int y = 0; y < tile; ++y) {
+            for (int x = 0; x < tile; ++x) {
+                double w = (0.5 - 0.5 * std::cos(2 * PI * y / tile)) * (0.5 - 0.5 * std::cos(2 * PI * x / tile));
+                windowed(y, x) = MyComplex<>(w * pixels[(map.tileTop(gy) + y) * cols + map.tileLeft(gx) + x], 0);
+            }
+        }
+        fft2D(windowed, false);
+        assert(nearlyEqual(map(gy, gx), calculateBlurriness(windowed), 2e-3) && "Paired tile differs from a direct tile FFT");
+    }
+
+    assert(map(2, 0) > 2 * map(2, map.gridCols - 1) && "Noise should score sharper than a ramp");
+    std::cout << "Blur map tests passed." << std::endl;
+}
+
+// Test every precision of the pipeline against fp64, including fp16 on an image whose DC term exceeds its range
+void testPrecisions() {
+    Precision parsed;
+    for (Precision precision : {Precision::Half, Precision::BFloat16, Precision::FloatX, Precision::Single, Precision::Double}) {
+        assert(parsePrecision(precisionName(precision), parsed) && parsed == precision && "Precision names do not round trip");
+    }
+    assert(!parsePrecision("fp8", parsed) && "Unknown precision was accepted");
+    assert(sizeof(MyComplex<float>) == 2 * sizeof(float) && sizeof(MyComplex<double>) == 2 * sizeof(double) && "Native formats must be plain floats");
+
+    const int rows = 128, cols = 120;
+    std::vector<unsigned char> pixels(rows * cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            pixels[y * cols + x] = static_cast<unsigned char>(200 + (x * 7 + y * y) % 56);
+        }
+    }
+    ComplexMatrix<double> reference;
+    rfft2D(pixels.data(), cols, rows, cols, reference);
+    const double expected = calculateBlurriness(reference);
+    double largest = 0.0;
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < reference.cols; ++x) {
+            largest = std::max(largest, std::hypot(reference(y, x).real, reference(y, x).imag));
+        }
+    }
+
+    for (Precision precision : {Precision::Half, Precision::BFloat16, Precision::FloatX, Precision::Single, Precision::Double}) {
+        dispatchPrecision(precision, [&](auto tag) {
+            typedef typename decltype(tag)::type T;
+            const double tolerance = std::ldexp(32.0, -ScalarTraits<T>::significandBits);
+            ComplexMatrix<T> spectrum;
+            rfft2D(pixels.data(), cols, rows, cols, spectrum);
+            double error = 0.0;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < spectrum.cols; ++x) {
+                    const double real = static_cast<double>(spectrum(y, x).real) / spectrum.scale;
+                    const double imag = static_cast<double>(spectrum(y, x).imag) / spectrum.scale;
+                    error = std::max(error, std::hypot(real - reference(y, x).real, imag - reference(y, x).imag));
+                }
+            }
+            assert(error <= tolerance * largest && "Spectrum is less accurate than its format allows");
+            const double score = blurScore<T>(pixels.data(), cols, rows, cols);
+            assert(std::isfinite(score) && std::fabs(score - expected) <= 8 * tolerance && "Blurriness drifted in a narrower format");
+        });
+    }
+
+    // Prime lengths go through Bluestein's convolution, which grows values by up to n (2n - 1)
+    const int primeRows = 127, primeCols = 131;
+    std::vector<unsigned char> bright(primeRows * primeCols);
+    for (size_t i = 0; i < bright.size(); ++i) {
+        bright[i] = static_cast<unsigned char>(200 + (i * 13) % 56);
+    }
+    ComplexMatrix<double> primeReference;
+    rfft2D(bright.data(), primeCols, primeRows, primeCols, primeReference);
+    ComplexMatrix<FloatHalf> primeSpectrum;
+    rfft2D(bright.data(), primeCols, primeRows, primeCols, primeSpectrum);
+    for (int y = 0; y < primeRows; ++y) {
+        for (int x = 0; x < primeSpectrum.cols; ++x) {
+            assert(std::isfinite(static_cast<double>(primeSpectrum(y, x).real)) && std::isfinite(static_cast<double>(primeSpectrum(y, x).imag)) && "fp16 overflowed on a Bluestein length");
+        }
+    }
+    const double primeScore = blurScore<FloatHalf>(bright.data(), primeCols, primeRows, primeCols);
+    assert(std::fabs(primeScore - calculateBlurriness(primeReference)) <= 8 * std::ldexp(32.0, -10) && "fp16 blurriness drifted on a Bluestein length");
+    std::cout << "Precision tests passed." << std::endl;
+}
+
+// Test the streamed spectrum against the in-memory one: same .npy bytes and the same blurriness
+void testStreamSpectrum() {
+    const int rows = 37, cols = 50;
+    std::vector<unsigned char> pixels(rows * cols);
+    for (int i = 0; i < rows * cols; ++i) {
+        pixels[i] = static_cast<unsigned char>((i * 7919 + i / cols * 31) % 251);
+    }
+    ProcessOptions options;
+    options.memoryBudget = 2048; // Strips of 2 rows and panels of 8 columns
+    assert(spectrumExceedsBudget<FloatX>(rows, cols, options) && !spectrumExceedsBudget<FloatX>(4, 4, options) && "Wrong budget check");
+
+    auto readFile = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    };
+    const std::string memoryPath = (fs::temp_directory_path() / "newfft_test_memory.npy").string();
+    const std::string streamPath = (fs::temp_directory_path() / "newfft_test_stream.npy").string();
+    for (Precision precision : {Precision::FloatX, Precision::Half}) {
+        dispatchPrecision(precision, [&](auto tag) {
+            typedef typename decltype(tag)::type T;
+            ComplexMatrix<T> spectrum;
+            rfft2D(pixels.data(), cols, rows, cols, spectrum);
+            assert(saveFFTResultsNpy(spectrum, memoryPath) && "saveFFTResultsNpy failed");
+
+            double blurriness = 0.0;
+            std::string error;
+            assert(streamSpectrum<T>(pixels.data(), cols, rows, cols, options, streamPath, blurriness, error) && "streamSpectrum failed");
+            assert(blurriness == calculateBlurriness(spectrum) && "Streamed blurriness differs");
+            assert(readFile(streamPath) == readFile(memoryPath) && "Streamed spectrum differs");
+            assert(readFile(fs::path(streamPath).replace_extension(".json").string()) ==
+                   readFile(fs::path(memoryPath).replace_extension(".json").string()) && "Streamed spectrum description differs");
+        });
+    }
+    for (const std::string& path : {memoryPath, streamPath}) {
+        fs::remove(path);
+        fs::remove(fs::path(path).replace_extension(".json"));
+    }
+    std::cout << "Streaming spectrum tests passed." << std::endl;
+}
+
+// Test the stage timers, the counters and the trace file
+void testTrace() {
+    const int rows = 24, cols = 40;
+    Mat img(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            img.at<uchar>(y, x) = static_cast<uchar>((x * 37 + y * y * 11) % 256);
+        }
+    }
+    const std::string base = (fs::temp_directory_path() / "newfft_test_trace.png").string();
+    const std::string npyPath = base + "_fft_results.npy";
+    const std::string tracePath = (fs::temp_directory_path() / "newfft_test_trace.json").string();
+    ProcessOptions options;
+    options.headless = true;
+
+    // Off by default: nothing is recorded
+    auto spans = [] {
+        size_t count = 0;
+        for (const auto& thread : fftTracer.threads()) count += thread->events.size();
+        return count;
+    };
+    const size_t before = spans();
+    assert(!fftTracer.enabled() && "Tracing must be off by default");
+    analyzeImage(img, "", options);
+    assert(spans() == before && "Spans recorded while tracing is off");
+
+    const long long transforms = fftCounters.transforms;
+    const long long bytesWritten = fftCounters.bytesWritten;
+    const long long allocations = fftCounters.allocations;
+    fftTracer.start();
+    ComplexMatrix<> spectrum;
+    ImageReport report = analyzeImage(img, spectrum, base, options);
+    fftTracer.sampleCounters();
+    fftTracer.stop();
+    assert(report.ok && "analyzeImage failed");
+    assert(fftCounters.transforms - transforms == (rows + 1) / 2 + cols / 2 + 1 && "Wrong transform count");
+    assert(fftCounters.bytesWritten - bytesWritten == static_cast<long long>(fs::file_size(npyPath)) && "Wrong byte count");
+    assert(fftCounters.allocations > allocations && "The spectrum allocation was not counted");
+    assert(writeTrace(tracePath) && "writeTrace failed");
+
+    std::ifstream file(tracePath);
+    const std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    assert(trace.rfind("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", 0) == 0 && "Not a Chrome trace");
+    for (const char* stage : {"row pass", "column pass", "metric", "output"}) {
+        assert(trace.find("{\"name\": \"" + std::string(stage) + "\", \"cat\": \"fft\", \"ph\": \"X\"") != std::string::npos && "Missing stage span");
+    }
+    assert(trace.find("\"transforms\": " + std::to_string(fftCounters.transforms.load())) != std::string::npos && "Missing counter sample");
+
+    fs::remove(npyPath);
+    fs::remove(fs::path(npyPath).replace_extension(".json"));
+    fs::remove(tracePath);
+    std::cout << "Trace tests passed." << std::endl;
+}
+
+// Several producers and consumers through a small queue: every value arrives exactly once
+void testBoundedQueue() {
+    BoundedQueue<int> queue(5); // Rounded up to 8
+    int value = 0;
+    assert(!queue.tryPop(value) && "Empty queue popped a value");
+    for (int i = 0; i < 8; ++i) {
+        value = i;
+        assert(queue.tryPush(value) && "Push failed below capacity");
+    }
+    value = 8;
+    assert(!queue.tryPush(value) && value == 8 && "Push succeeded on a full queue");
+    for (int i = 0; i < 8; ++i) {
+        assert(queue.tryPop(value) && value == i && "Values came out of order");
+    }
+
+    const int producers = 4, consumers = 3, perProducer = 5000;
+    std::atomic<long long> sum{0};
+    std::atomic<int> popped{0};
+    vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (int i = 1; i <= perProducer; ++i) {
+                int item = p * perProducer + i;
+                while (!queue.tryPush(item)) std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            int item;
+            while (popped.load() < producers * perProducer) {
+                if (queue.tryPop(item)) {
+                    sum += item;
+                    ++popped;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    const long long count = producers * perProducer;
+    assert(popped == count && sum == count * (count + 1) / 2 && "Values were lost or duplicated");
+
+    // The blocking calls: consumers sleep until values arrive and stop once the queue is closed
+    sum = 0;
+    popped = 0;
+    threads.clear();
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            int item;
+            while (queue.pop(item)) {
+                sum += item;
+                ++popped;
+            }
+        });
+    }
+    vector<std::thread> producing;
+    for (int p = 0; p < producers; ++p) {
+        producing.emplace_back([&, p] {
+            for (int i = 1; i <= perProducer; ++i) {
+                int item = p * perProducer + i;
+                queue.push(item);
+            }
+        });
+    }
+    for (auto& thread : producing) thread.join();
+    queue.close();
+    for (auto& thread : threads) thread.join();
+    assert(popped == count && sum == count * (count + 1) / 2 && "Blocking push and pop lost or duplicated values");
+    assert(!queue.pop(value) && "A closed, empty queue returned a value");
+    std::cout << "Bounded queue tests passed." << std::endl;
+}
+
+// Test the batch scanner: recursion and extension rules, failures, and cache hits by path and by content
+void testScanImages() {
+    const fs::path root = fs::temp_directory_path() / "newfft_test_scan";
+    fs::remove_all(root);
+    fs::create_directories(root / "sub" / "deeper");
+    // Binary PGM under image extensions: OpenCV picks the decoder from the contents
+    auto writeImage = [](const fs::path& path, int rows, int cols, int seed) {
+        std::ofstream file(path, std::ios::binary);
+        file << "P5\n" << cols << " " << rows << "\n255\n";
+        for (int i = 0; i < rows * cols; ++i) file.put(static_cast<char>((i * seed + i / cols * 7) % 256));
+    };
+    writeImage(root / "a.png", 20, 30, 13);
+    writeImage(root / "sub" / "b.jpg", 17, 24, 31);
+    writeImage(root / "sub" / "deeper" / "c.jpeg", 16, 16, 5);
+    writeImage(root / "sub" / "ignored.pgm", 16, 16, 5);
+    std::ofstream(root / "broken.png") << "not an image";
+
+    vector<std::string> paths;
+    std::string error;
+    assert(findImages(root.string(), paths, error) && paths.size() == 4 && "findImages picked the wrong files");
+
+    ScanOptions scan;
+    scan.fftWorkers = 3;
+    scan.cachePath = (root / "cache.tsv").string();
+    scan.outputPath = (root / "scan.jsonl").string();
+    ProcessOptions options;
+    setFFTThreadCount(2);
+    auto run = [&] {
+        assert(scanImages(root.string(), options, scan) == 0 && "scanImages failed");
+        assert(fftThreadCount == 2 && "scanImages did not restore the FFT thread count");
+        std::map<std::string, std::string> records;
+        std::ifstream file(scan.outputPath);
+        std::string line;
+        while (std::getline(file, line)) {
+            const size_t start = line.find("\"path\": \"") + 9;
+            records[fs::path(line.substr(start, line.find('"', start) - start)).filename().string()] = line;
+        }
+        return records;
+    };
+    auto blurriness = [](const std::string& record) {
+        return std::stod(record.substr(record.find("\"blurriness\": ") + 14));
+    };
+
+    auto first = run();
+    assert(first.size() == 4 && "Expected one record per image file");
+    assert(first["broken.png"].find("\"ok\": false") != std::string::npos && "Broken image was not reported");
+    Mat b = imread((root / "sub" / "b.jpg").string(), IMREAD_GRAYSCALE);
+    assert(first["b.jpg"].find("\"cached\": false") != std::string::npos && "Nothing should be cached yet");
+    assert(std::fabs(blurriness(first["b.jpg"]) - blurScore<FloatX>(b, defaultBlurCutoff)) < 1e-8 && "Scanned blurriness differs from blurScore");
+
+    fs::copy_file(root / "a.png", root / "copy.png");
+    auto second = run();
+    assert(second.size() == 5 && "The copy was not found");
+    for (const char* name : {"a.png", "b.jpg", "c.jpeg", "copy.png"}) {
+        assert(second[name].find("\"cached\": true") != std::string::npos && "Unchanged file was analyzed again");
+        assert(blurriness(second[name]) == blurriness(first[name == std::string("copy.png") ? "a.png" : name]) && "Cached blurriness differs");
+    }
+    assert(second["broken.png"].find("\"cached\": false") != std::string::npos && "Failures must not be cached");
+
+    // A rewritten file must not leave its old content pointing at its new score,
+    // also when the log still holds both lines because it was never compacted
+    std::stringstream log;
+    log << std::ifstream(scan.cachePath).rdbuf();
+    const fs::path rewritten = root / "sub" / "b.jpg";
+    writeImage(rewritten, 17, 24, 37);
+    fs::last_write_time(rewritten, fs::last_write_time(rewritten) + std::chrono::seconds(10));
+    auto changed = run();
+    assert(changed["b.jpg"].find("\"cached\": false") != std::string::npos && blurriness(changed["b.jpg"]) != blurriness(first["b.jpg"]) && "Rewritten file was not analyzed again");
+    {
+        std::ifstream compacted(scan.cachePath);
+        std::string line;
+        while (std::getline(compacted, line)) {
+            if (line[0] != '#') log << line << "\n";
+        }
+    }
+    std::ofstream(scan.cachePath, std::ios::trunc) << log.str();
+    writeImage(root / "old_b.png", 17, 24, 31);
+    auto original = run();
+    assert(blurriness(original["old_b.png"]) == blurriness(first["b.jpg"]) && "Old content was given the score of the rewritten file");
+
+    options.precision = Precision::Single;
+    auto third = run();
+    assert(third["a.png"].find("\"cached\": false") != std::string::npos && "Cache ignored the precision");
+
+    fs::remove_all(root);
+    setFFTThreadCount(0);
+    std::cout << "Scan tests passed." << std::endl;
+}
+
+// Test the video pipeline on a numbered frame sequence: frame order, stride, skip and the sharpest frames
+void testAnalyzeVideo() {
+    const fs::path root = fs::temp_directory_path() / "newfft_test_video";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    for (int i = 0; i < 12; ++i) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%03d.pgm", i);
+        std::ofstream file(root / name, std::ios::binary);
+        file << "P5\n40 30\n255\n";
+        for (int p = 0; p < 40 * 30; ++p) file.put(static_cast<char>((p % 40) * (i + 1) * 3 % 256));
+    }
+    const std::string source = (root / "frame_%03d.pgm").string();
+
+    // What the pipeline should find, frame by frame, read straight from the same source
+    vector<double> expected;
+    VideoCapture capture(source);
+    Mat frame, gray;
+    while (capture.read(frame) && !frame.empty()) {
+        if (frame.channels() == 1) gray = frame;
+        else cvtColor(frame, gray, COLOR_BGR2GRAY);
+        expected.push_back(blurScore<FloatX>(gray, defaultBlurCutoff));
+    }
+    assert(expected.size() >= 8 && "Frame sequence could not be read");
+
+    VideoOptions video;
+    video.skip = 1;
+    video.stride = 3;
+    video.topFrames = 2;
+    video.workers = 3;
+    video.outputPath = (root / "timeline.jsonl").string();
+    setFFTThreadCount(2);
+    assert(analyzeVideo(source, ProcessOptions(), video) == 0 && "analyzeVideo failed");
+    assert(fftThreadCount == 2 && "analyzeVideo did not restore the FFT thread count");
+
+    std::ifstream file(video.outputPath);
+    std::string line;
+    vector<int> frames;
+    std::string summary;
+    while (std::getline(file, line)) {
+        if (line.rfind("{\"frame\": ", 0) != 0) {
+            summary = line;
+            continue;
+        }
+        const int index = std::atoi(line.c_str() + 10);
+        const double blurriness = std::stod(line.substr(line.find("\"blurriness\": ") + 14));
+        assert(std::abs(blurriness - expected[index]) <= 1e-8 && "Frame score differs from blurScore");
+        frames.push_back(index);
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        assert(frames[i] == 1 + 3 * static_cast<int>(i) && "Frames are out of order or the stride is wrong");
+    }
+    assert(frames.size() == (expected.size() - 1 + 2) / 3 && "Wrong number of frames scored");
+
+    // The two sharpest of the scored frames, sharpest first
+    vector<int> ranked = frames;
+    std::sort(ranked.begin(), ranked.end(), [&](int a, int b) { return expected[a] > expected[b] || (expected[a] == expected[b] && a < b); });
+    const std::string sharpest = "\"sharpest_frames\": [" + std::to_string(ranked[0]) + ", " + std::to_string(ranked[1]) + "]";
+    assert(summary.find(sharpest) != std::string::npos && "Wrong sharpest frames");
+    assert(summary.find("\"frames_read\": " + std::to_string(expected.size())) != std::string::npos && "Wrong frame count");
+
+    fs::remove_all(root);
+    setFFTThreadCount(0);
+    std::cout << "Video pipeline tests passed." << std::endl;
+}
+
 int main() {
     std::cout << "Starting detailed tests...\n";
     testIsPowerOfTwo();
     testNextPowerOfTwo();
     testMyComplexOperations();
-    testFFT();  // Example placeholder for more detailed FFT testing
+    testFFT();
+    testFFTMatchesDFT();
+    testArbitraryLengthFFT();
+    testFFT2D();
+    testFFT2DThreads();
+    testSimdMatchesScalar();
+    testRealFFT2D();
+    testSaveFFTResultsNpy();
+    testServeRequests();
+    testBlurScore();
+    testBlurMap();
+    testPrecisions();
+    testStreamSpectrum();
+    testTrace();
+    testBoundedQueue();
+    testScanImages();
+    testAnalyzeVideo();
     std::cout << "All detailed tests completed successfully.\n";
     return 0;
 }
@@ -0,0 +1,96 @@
+import ctypes
+import numpy as np
+import unittest
+from main import calculate_blurriness_ratio
+
+try:
+    import newfft
+except ImportError:
+    newfft = None
+
+class PyBuffer(ctypes.Structure):
+    _fields_ = [('buf', ctypes.c_void_p), ('obj', ctypes.py_object), ('len', ctypes.c_ssize_t), ('itemsize', ctypes.c_ssize_t),
+                ('readonly', ctypes.c_int), ('ndim', ctypes.c_int), ('format', ctypes.c_char_p), ('shape', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('strides', ctypes.POINTER(ctypes.c_ssize_t)), ('suboffsets', ctypes.c_void_p), ('internal', ctypes.c_void_p)]
+
+@unittest.skipIf(newfft is None, 'newfft extension not built (python3 setup.py build_ext --inplace)')
+class TestExtensionModule(unittest.TestCase):
+    def setUp(self):
+        self.image = np.random.randint(0, 256, (24, 30), dtype=np.uint8)
+        # NewFFT's forward transform uses the e^(+i) convention, i.e. numpy's unscaled inverse
+        self.expected = np.fft.ifft2(self.image.astype(np.float64)) * self.image.size
+
+    def test_fft2_matches_numpy(self):
+        spectrum = newfft.fft2(self.image)
+        self.assertEqual(spectrum.shape, (24, 30))
+        self.assertTrue(np.allclose(spectrum, self.expected, rtol=0, atol=1e-3 * np.abs(self.expected).max()))
+
+    def test_rfft2_is_a_view_of_the_half_spectrum(self):
+        spectrum = newfft.rfft2(self.image)
+        self.assertEqual(spectrum.shape, (24, 16))
+        self.assertFalse(spectrum.flags['OWNDATA'])
+        self.assertTrue(np.allclose(spectrum, self.expected[:, :16], rtol=0, atol=1e-3 * np.abs(self.expected).max()))
+
+    def test_buffer_without_format_is_bytes(self):
+        # A consumer that does not ask for the format takes the items as unsigned bytes
+        spectrum = newfft.rfft2(self.image)
+        exporter = spectrum.base.obj
+        PyBUF_ND = 0x0008
+        view = PyBuffer()
+        ctypes.pythonapi.PyObject_GetBuffer.argtypes = [ctypes.py_object, ctypes.POINTER(PyBuffer), ctypes.c_int]
+        ctypes.pythonapi.PyBuffer_Release.argtypes = [ctypes.POINTER(PyBuffer)]
+        self.assertEqual(ctypes.pythonapi.PyObject_GetBuffer(exporter, ctypes.byref(view), PyBUF_ND), 0)
+        try:
+            self.assertIsNone(view.format)
+            self.assertEqual(view.itemsize, 1)
+            self.assertEqual((view.ndim, view.shape[0], view.shape[1]), (2, 24, spectrum.nbytes // 24))
+            self.assertEqual(view.len, spectrum.nbytes)
+        finally:
+            ctypes.pythonapi.PyBuffer_Release(ctypes.byref(view))
+
+    def test_float32_and_strided_input(self):
+        strided = self.image[::2, ::1]
+        a = newfft.rfft2(strided)
+        b = newfft.rfft2(np.ascontiguousarray(strided).astype(np.float32))
+        self.assertTrue(np.array_equal(a, b))
+
+    def test_blurriness_matches_analyze(self):
+        score, spectrum = newfft.analyze(self.image)
+        self.assertAlmostEqual(score, newfft.blurriness(self.image), places=12)
+        self.assertEqual(spectrum.shape, (24, 16))
+
+    def test_rejects_unsupported_images(self):
+        with self.assertRaises(TypeError):
+            newfft.rfft2(np.zeros((4, 4), dtype=np.int64))
+        with self.assertRaises(ValueError):
+            newfft.rfft2(np.zeros(4, dtype=np.uint8))
+
+    def test_blurriness_matches_python_metric(self):
+        for cutoff in (0.1, 0.2, 0.35):
+            expected = calculate_blurriness_ratio(np.fft.fft2(self.image), cutoff)
+            self.assertAlmostEqual(newfft.blurriness(self.image, cutoff=cutoff), expected, places=3)
+
+    def test_blur_map_finds_the_blurred_region(self):
+        image = np.random.randint(0, 256, (64, 128), dtype=np.uint8)
+        image[:, 64:] = 128  # Flat right half
+        grid = newfft.blur_map(image, tile=32)
+        self.assertEqual(grid.shape, (3, 7))
+        self.assertTrue(np.all(grid[:, 0] > grid[:, -1]))
+
+    def test_every_precision_matches_numpy(self):
+        # A bright image, so fp16 only works because its input is scaled into range
+        image = np.random.randint(200, 256, (64, 80), dtype=np.uint8)
+        expected = np.fft.ifft2(image.astype(np.float64)) * image.size
+        score = calculate_blurriness_ratio(np.fft.fft2(image))
+        dtypes = {'fp16': np.complex128, 'bf16': np.complex128, 'floatx': np.complex128,
+                  'fp32': np.complex64, 'fp64': np.complex128}
+        self.assertEqual(set(newfft.precisions), set(dtypes))
+        for name in newfft.precisions:
+            significand_bits = newfft.precision(name)[1]
+            tolerance = 32.0 * 2.0 ** -significand_bits
+            spectrum = newfft.rfft2(image, precision=name)
+            self.assertEqual(spectrum.dtype, dtypes[name])
+            self.assertLessEqual(np.abs(spectrum - expected[:, :41]).max(), tolerance * np.abs(expected).max())
+            self.assertAlmostEqual(newfft.blurriness(image, precision=name), score, delta=8 * tolerance)
+        with self.assertRaises(ValueError):
+            newfft.blurriness(image, precision='fp8')
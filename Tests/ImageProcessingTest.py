@@ -1,5 +1,8 @@
+import json
+import os
+import tempfile
 import numpy as np
-from main import create_mask_from_fft
+from main import calculate_blurriness_ratio, create_mask_from_fft, load_fft_results
 import unittest
 
 class TestImageProcessing(unittest.TestCase):
@@ -17,3 +20,25 @@ class TestImageProcessing(unittest.TestCase):
         # Expect a significant number of ones in the mask due to high frequencies
         self.assertTrue(np.count_nonzero(mask) > 20)
 
+    def test_load_fft_results_expands_half_spectrum(self):
+        # NewFFT stores only cols // 2 + 1 columns of a real image's spectrum
+        spectrum = np.fft.fft2(np.random.rand(7, 10)).astype(np.complex64)
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'image.png_fft_results.npy')
+            np.save(path, spectrum[:, :6])
+            with open(os.path.join(directory, 'image.png_fft_results.json'), 'w') as file:
+                json.dump({'rows': 7, 'cols': 6, 'full_cols': 10, 'half_spectrum': True}, file)
+            loaded = load_fft_results(path)
+        self.assertEqual(loaded.shape, (7, 10))
+        self.assertTrue(np.allclose(loaded, spectrum, atol=1e-4))
+
+    def test_blurriness_ratio_uses_normalized_frequency(self):
+        # Only the zero frequency: no detail at all
+        fft_data = np.zeros((8, 10), dtype=complex)
+        fft_data[0, 0] = 5
+        self.assertEqual(calculate_blurriness_ratio(fft_data), 0)
+        # fx = 3 / 10 is above the default cutoff of 0.2, fx = 2 / 10 is not
+        fft_data[0, 3] = 5
+        fft_data[0, 2] = 10
+        self.assertAlmostEqual(calculate_blurriness_ratio(fft_data), 0.25)
+        self.assertAlmostEqual(calculate_blurriness_ratio(fft_data, cutoff=0.1), 0.75)
@@ -6,10 +6,16 @@ import numpy as np
 import matplotlib.pyplot as plt
 import easygui
 import glob
+import json
 import subprocess
 import skimage.segmentation
 import skimage.measure
 
+try:
+    import newfft  # In-process FFT engine, built with: python3 setup.py build_ext --inplace
+except ImportError:
+    newfft = None
+
 class DragAndDropGUI:
     def __init__(self):
         self.image_paths = []
@@ -58,12 +64,38 @@ def xfind_images(directory, recursive=False, ignore=True):
         if check_a and check_b:
             yield path_a
 
+def fft_results_path(image_path):
+    # NewFFT writes .npy by default and .csv only when run with --csv
+    npy_path = image_path + "_fft_results.npy"
+    return npy_path if os.path.exists(npy_path) else image_path + "_fft_results.csv"
+
 def load_fft_results(file_path):
+    if file_path.endswith('.npy'):
+        return load_fft_results_npy(file_path)
     with open(file_path, 'r') as file:
         lines = file.readlines()
     fft_data = [np.array([complex(float(val.split(',')[0]), float(val.split(',')[1])) for val in line.split()]) for line in lines]
     return np.array(fft_data)
 
+def load_fft_results_npy(file_path):
+    # Memory-mapped, so nothing is parsed or copied until the data is used
+    data = np.load(file_path, mmap_mode='r')
+    meta_path = os.path.splitext(file_path)[0] + '.json'
+    if not os.path.exists(meta_path):
+        return data
+    with open(meta_path, 'r') as file:
+        meta = json.load(file)
+    if not meta.get('half_spectrum'):
+        return data
+    # A real image's spectrum is stored as its first full_cols // 2 + 1 columns,
+    # the rest are conjugates of mirrored bins: X[y, x] = conj(X[-y, -x])
+    rows, cols, full_cols = data.shape[0], data.shape[1], meta['full_cols']
+    full = np.empty((rows, full_cols), dtype=data.dtype)
+    full[:, :cols] = data
+    mirrored_cols = full_cols - np.arange(cols, full_cols)
+    full[:, cols:] = np.conj(data[(-np.arange(rows)) % rows][:, mirrored_cols])
+    return full
+
 def display(title, img, max_size=200000):
     scale = np.sqrt(min(1.0, float(max_size) / (img.shape[0] * img.shape[1])))
     shape = (int(scale * img.shape[1]), int(scale * img.shape[0]))
@@ -72,17 +104,17 @@ def display(title, img, max_size=200000):
     cv2.waitKey(0)
     cv2.destroyAllWindows()
 
-def calculate_blurriness_ratio(fft_data):
+def calculate_blurriness_ratio(fft_data, cutoff=0.2):
+    # Same metric as calculateBlurriness in NewFFT.cpp: the share of the spectrum's
+    # magnitude at normalized frequencies max(|fy|, |fx|) > cutoff, on an unshifted
+    # spectrum. Runs from 0 to 1, lower means blurrier.
     magnitude_spectrum = np.abs(fft_data)
     total_energy = np.sum(magnitude_spectrum)
     rows, cols = magnitude_spectrum.shape
-    crow, ccol = rows // 2, cols // 2
-    hfreq_mask = np.zeros_like(magnitude_spectrum)
-    hfreq_mask[:crow//2, :] = 1
-    hfreq_mask[(crow//2)*3:, :] = 1
-    hfreq_mask[:, :ccol//2] = 1
-    hfreq_mask[:, (ccol//2)*3:] = 1
-    high_freq_energy = np.sum(magnitude_spectrum * hfreq_mask)
+    fy = np.abs(np.fft.fftfreq(rows))[:, None]
+    fx = np.abs(np.fft.fftfreq(cols))[None, :]
+    hfreq_mask = np.maximum(fy, fx) > cutoff
+    high_freq_energy = np.sum(magnitude_spectrum[hfreq_mask])
     return high_freq_energy / total_energy if total_energy > 0 else 0
 
 def create_mask_from_fft(fft_data):
@@ -99,22 +131,90 @@ def run_fft_analysis(image_paths):
         command = ['./NewFFT', image_path]
         subprocess.run(command, check=True)
         # Load FFT results
-        fft_file = image_path + "_fft_results.csv"
+        fft_file = fft_results_path(image_path)
         fft_results = load_fft_results(fft_file)
         blurriness_ratio = calculate_blurriness_ratio(fft_results)
-        print(f"Blurriness (0=Very Sharp, 1=Very Blurry): {blurriness_ratio}")
+        print(f"Blurriness ratio (lower is blurrier): {blurriness_ratio}")
         # Optionally, display a mask or the original image for visual inspection
         img = cv2.imread(image_path)
         if img is not None:
             display("Processed Image", img)
 
-def visualize_blurriness_heatmap(fft_data):
-    magnitude = np.abs(fft_data)
-    magnitude_log = np.log1p(magnitude)
+class FFTServer:
+    # One long-lived headless ./NewFFT --serve process: plans and buffers stay
+    # warm between images and no window is ever opened
+    def __init__(self, executable='./NewFFT', save_spectrum=False, precision='floatx'):
+        command = [executable, '--serve', '--precision', precision] + (['--save-spectrum'] if save_spectrum else [])
+        self.process = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+
+    def analyze(self, image_path):
+        self.process.stdin.write(image_path.encode() + b'\n')
+        return self._reply()
+
+    def analyze_frame(self, frame):
+        frame = np.ascontiguousarray(frame, dtype=np.uint8)
+        rows, cols = frame.shape
+        self.process.stdin.write(f'frame {rows} {cols}\n'.encode() + frame.tobytes())
+        return self._reply()
+
+    def _reply(self):
+        line = self.process.stdout.readline()
+        if not line:
+            raise RuntimeError('NewFFT server exited')
+        return json.loads(line)
+
+    def close(self):
+        if self.process.poll() is None:
+            self.process.stdin.write(b'quit\n')
+            self.process.stdin.close()
+            self.process.wait()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+def load_blur_map(image_path):
+    return np.load(image_path + "_blur_map.npy")
+
+def compute_fft_and_blur_map(image_path, tile=64):
+    # Spectrum and tile blur map of one image from a single decode. Uses the
+    # extension module when it is built, so nothing goes through files; otherwise
+    # one ./NewFFT --blur-map run writes both and shows the image and its spectrum
+    if newfft is not None:
+        img = cv2.imread(image_path, cv2.IMREAD_GRAYSCALE)
+        if img is None:
+            raise ValueError(f'Failed to load image: {image_path}')
+        return newfft.fft2(img), newfft.blur_map(img, tile=tile)
+    subprocess.run(['./NewFFT', '--blur-map', str(tile), image_path], check=True)
+    return load_fft_results(fft_results_path(image_path)), load_blur_map(image_path)
+
+def score_images(image_paths, executable='./NewFFT', precision='floatx'):
+    with FFTServer(executable, precision=precision) as server:
+        return [server.analyze(path) for path in image_paths]
+
+def scan_images(target, executable='./NewFFT', precision='floatx', cache=True):
+    # ./NewFFT --scan decodes and scores a whole directory (or glob) in parallel
+    # and skips files already in its cache; yields one result per file as it finishes
+    command = [executable, '--scan', target, '--precision', precision] + ([] if cache else ['--no-cache'])
+    with subprocess.Popen(command, stdout=subprocess.PIPE) as process:
+        for line in process.stdout:
+            yield json.loads(line)
+    if process.returncode != 0:
+        raise RuntimeError(f'NewFFT --scan failed on {target}')
+
+def visualize_blurriness_heatmap(blur_map, image=None):
+    # blur_map is the per-tile grid from compute_fft_and_blur_map; it is stretched over the image when one is given
     plt.figure(figsize=(10, 6))
-    plt.imshow(magnitude_log, cmap='inferno')
-    plt.colorbar()
-    plt.title('Blurriness Heatmap (Log Scale)')
+    if image is not None:
+        extent = (0, image.shape[1], image.shape[0], 0)
+        plt.imshow(image, cmap='gray', extent=extent)
+        plt.imshow(blur_map, cmap='inferno', alpha=0.5, interpolation='bilinear', extent=extent)
+    else:
+        plt.imshow(blur_map, cmap='inferno', interpolation='nearest')
+    plt.colorbar(label='High frequency share (lower is blurrier)')
+    plt.title('Blurriness Heatmap')
     plt.axis('off')
     plt.show()
 
@@ -133,19 +233,33 @@ def main():
     
     for img_path in resolved_paths:
         print(f"Processing image: {img_path}")
-        subprocess.run(['./NewFFT', img_path], check=True)
-        
-        fft_file = img_path + "_fft_results.csv"
-        fft_results = load_fft_results(fft_file)
+        fft_results, blur_map = compute_fft_and_blur_map(img_path)
         
         blurriness_ratio = calculate_blurriness_ratio(fft_results)        
-        visualize_blurriness_heatmap(fft_results)
-        
+        print(f"Blurriness ratio (lower is blurrier): {blurriness_ratio}")
         img = cv2.imread(img_path)
+        visualize_blurriness_heatmap(blur_map, None if img is None else cv2.cvtColor(img, cv2.COLOR_BGR2RGB))
+        
         if img is not None:
             display("Processed Image", img)
         else:
             print(f"Failed to load the processed image: {img_path}")
 
 if __name__ == "__main__":
-    main()
+    parser = argparse.ArgumentParser(description='Image blur tester')
+    parser.add_argument('paths', nargs='*', help='images, directories or globs to score without the GUI')
+    parser.add_argument('--headless', action='store_true', help='print one JSON line per image instead of opening windows')
+    parser.add_argument('--precision', default='floatx', choices=['fp16', 'bf16', 'floatx', 'fp32', 'fp64'],
+                        help='number format of the FFT')
+    parser.add_argument('--scan', action='store_true', help='with --headless, score directories and globs with ./NewFFT --scan and its result cache')
+    args = parser.parse_args()
+    if args.headless and args.scan:
+        for path in args.paths:
+            for result in scan_images(path, precision=args.precision):
+                print(json.dumps(result))
+    elif args.headless:
+        paths = [image for path in args.paths for image in find_images(path)]
+        for result in score_images(paths, precision=args.precision):
+            print(json.dumps(result))
+    else:
+        main()
@@ -0,0 +1,22 @@
+# Builds the newfft Python extension: python3 setup.py build_ext --inplace
+# NEWFFT_EXPONENT_BITS / NEWFFT_SIGNIFICAND_BITS pick the FloatX format (default 8 / 12)
+import os
+import subprocess
+from setuptools import setup, Extension
+
+def pkg_config(*args):
+    return subprocess.check_output(['pkg-config', *args, 'opencv4'], text=True).split()
+
+macros = [('FFT_EXPONENT_BITS', os.environ.get('NEWFFT_EXPONENT_BITS', '8')),
+          ('FFT_SIGNIFICAND_BITS', os.environ.get('NEWFFT_SIGNIFICAND_BITS', '12'))]
+
+newfft = Extension(
+    'newfft',
+    sources=['NewFFTModule.cpp'],
+    language='c++',
+    define_macros=macros,
+    extra_compile_args=['-std=c++17', '-O2', '-pthread'] + pkg_config('--cflags'),
+    extra_link_args=['-pthread'] + pkg_config('--libs'),
+)
+
+setup(name='newfft', version='1.0', description='FloatX FFT blur detection', ext_modules=[newfft])